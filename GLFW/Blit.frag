@@ -0,0 +1,12 @@
+#version 330 core
+
+in vec2 texCoord;
+
+uniform sampler2D source;
+
+out vec3 color;
+
+void main()
+{
+    color = texture(source, texCoord).rgb;
+}
@@ -0,0 +1,11 @@
+#version 330 core
+
+// One triangle that covers the whole screen, corners made from the vertex id
+out vec2 texCoord;
+
+void main ()
+{
+    vec2 corner = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2);
+    texCoord = corner;
+    gl_Position = vec4(corner*2.0 - 1.0, 0, 1);
+}
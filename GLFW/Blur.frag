@@ -0,0 +1,21 @@
+#version 330 core
+
+in vec2 texCoord;
+
+uniform sampler2D source;
+uniform vec2 direction;     // one texel along the blur axis
+uniform int taps;           // fetches on each side, including the center
+uniform float offsets[5];   // in texels, between the two texels a fetch blends
+uniform float weights[5];
+
+out vec3 color;
+
+void main()
+{
+    vec3 sum = texture(source, texCoord).rgb*weights[0];
+    for (int i = 1; i < taps; i++) {
+        vec2 d = direction*offsets[i];
+        sum += (texture(source, texCoord + d).rgb + texture(source, texCoord - d).rgb)*weights[i];
+    }
+    color = sum;
+}
@@ -0,0 +1,20 @@
+#version 330 core
+
+// One quad per particle instance, corners made from the vertex id (triangle strip)
+layout (location = 0) in vec4 state;    // per instance : x, y, vx, vy
+layout (location = 1) in vec2 info;     // per instance : life left, palette index
+
+uniform mat4 VP;
+uniform float size;
+uniform vec3 palette[8];
+
+out vec3 fragColor;
+
+void main ()
+{
+    vec2 corner = vec2(gl_VertexID & 1, gl_VertexID >> 1) - 0.5;
+    // Shrink away over the last quarter second, dead ones collapse to a point
+    float s = size*clamp(info.x*4.0, 0.0, 1.0);
+    fragColor = palette[int(info.y)];
+    gl_Position = VP * vec4(state.xy + corner*s, 0, 1);
+}
@@ -0,0 +1,19 @@
+#version 330 core
+
+// One particle per vertex, written to the other buffer by transform feedback
+layout (location = 0) in vec4 state;    // x, y, vx, vy
+layout (location = 1) in vec2 info;     // life left, palette index
+
+uniform float dt;
+uniform float gravity;
+
+out vec4 outState;
+out vec2 outInfo;
+
+void main ()
+{
+    vec2 velocity = state.zw - vec2(0, gravity*dt);
+    outState = vec4(state.xy + velocity*dt, velocity);
+    // Keep dead particles from drifting towards -inf
+    outInfo = vec2(max(info.x - dt, -1.0), info.y);
+}
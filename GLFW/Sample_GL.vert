@@ -1,21 +1,23 @@
 #version 330 core
 
 // input data : sent from main program
-layout (location = 0) in vec3 vertexPosition;
-layout (location = 1) in vec3 vertexColor;
+layout (location = 0) in vec2 vertexPosition;  // int16, VERTEX_POSITION_SCALE steps per unit
+layout (location = 1) in vec4 vertexColor;     // RGBA8, normalized
 
 uniform mat4 MVP;
 
 // output data : used by fragment shader
 out vec3 fragColor;
 
+const float POSITION_SCALE = 1.0/8.0;
+
 void main ()
 {
-    vec4 v = vec4(vertexPosition, 1); // Transform an homogeneous 4D vector
+    vec4 v = vec4(vertexPosition*POSITION_SCALE, 0, 1); // Transform an homogeneous 4D vector
 
     // The color of each vertex will be interpolated
     // to produce the color of each fragment
-    fragColor = vertexColor;
+    fragColor = vertexColor.rgb;
 
     // Output position of the vertex, in clip space : MVP * position
     gl_Position = MVP * v;
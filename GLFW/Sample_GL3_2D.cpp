@@ -3,6 +3,9 @@
 #include <fstream>
 #include <vector>
 #include <map>
+#include <cstring>
+#include <cstdlib>
+#include <thread>
 
 #include <glad/glad.h>
 #include <GLFW/glfw3.h>
@@ -12,18 +15,23 @@
 #include <glm/gtx/transform.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 
-using namespace std;
-
-struct VAO {
-    GLuint VertexArrayID;
-    GLuint VertexBuffer;
-    GLuint ColorBuffer;
+#include "renderer.h"
+#include "profiler.h"
+#include "pacing.h"
+#include "replay.h"
+#include "spsc_queue.h"
+#include "offscreen.h"
+#include "shaders.h"
+#include "meshes.h"
+#include "rendertarget.h"
+#include "text.h"
+#include "particles.h"
+#include "bloom.h"
+#include "resolution.h"
+#include "audio.h"
+#include "mixer.h"
 
-    GLenum PrimitiveMode;
-    GLenum FillMode;
-    int NumVertices;
-};
-typedef struct VAO VAO;
+using namespace std;
 
 typedef struct COLOR
 {
@@ -60,14 +68,12 @@ struct GLMatrices {
 map <string, Sprite> BUCKET;
 map <string, Sprite> CANNON;
 map <string, Sprite> BRICKS;
-map <string, Sprite> SCORE1;
-map <string, Sprite> SCORE2;
-map <string, Sprite> SCORE3;
-map <string, Sprite> SCORE4;
 map <string, Sprite> LASER;
 map <string, Sprite> START_WINDOW;
 map <string, Sprite> MIRROR;
 map <string, Sprite> TEXT;
+map <string, Sprite> OVERLAY;
+map <string, Sprite> PARTICLES;
 
 float x_change = 0; //For the camera pan
 float y_change = 0; //For the camera pan
@@ -78,100 +84,140 @@ int gameOver = 0;
 int bricks_speed = 1;
 int start = 0;
 int pause = 0;
+int redraw_all = 1;     // input, resize or a state change: the next frame redraws everything
 int t1=0,t2=0;
 double prev_click = 0;
 float x_zoom = 400.0f;
 float y_zoom = 300.0f; 
 double time_curr = glfwGetTime();
 
-GLuint programID;
-
-/* Function to load Shaders - Use it as it is */
-GLuint LoadShaders(const char * vertex_file_path,const char * fragment_file_path) {
-
-	// Create the shaders
-	GLuint VertexShaderID = glCreateShader(GL_VERTEX_SHADER);
-	GLuint FragmentShaderID = glCreateShader(GL_FRAGMENT_SHADER);
-
-	// Read the Vertex Shader code from the file
-	std::string VertexShaderCode;
-	std::ifstream VertexShaderStream(vertex_file_path, std::ios::in);
-	if(VertexShaderStream.is_open())
-	{
-		std::string Line = "";
-		while(getline(VertexShaderStream, Line))
-			VertexShaderCode += "\n" + Line;
-		VertexShaderStream.close();
-	}
+/* Command line options for headless runs and input recording */
+struct Options {
+    int offscreen;             // --offscreen : hidden window, fixed frame count, virtual clock
+    long frames;               // --frames N : frames to render in offscreen mode
+    const char* replay_path;   // --replay FILE : feed recorded input back in
+    const char* record_path;   // --record FILE : save input events on exit
+    const char* dump_prefix;   // --dump-prefix PREFIX : PNG file name prefix
+    const char* timings_path;  // --timings FILE : per-frame render times as CSV
+    vector<long> dump_frames;  // --dump 10,20,30 : frames to write out as PNG
+    int software;              // --renderer soft : CPU rasterizer, no window or GL needed
+    int threads;               // --threads N : rasterizer workers (0 = one per core)
+    PacingMode pacing;         // --pacing vsync|uncapped|cap
+    double fps;                // --fps N : frame rate for --pacing cap
+    int late_latch;            // --late-latch : sample input right before submitting
+    int latency;               // --latency : measure input to swap completion
+    const char* shader_cache;  // --shader-cache DIR : program binary cache, --no-shader-cache turns it off
+    BloomQuality bloom;        // --bloom off|low|high : laser glow
+    float min_scale;           // --min-scale PERCENT : dynamic resolution floor, 100 turns it off
+    int audio;                 // --no-audio : don't open a sound device
+    const char* audio_out;     // --audio-out FILE : render the sound offline to a .wav/.raw file, or null
+    int bench_mixer;           // --bench-mixer : time the audio mixer and exit
+    const char* music;         // --music FILE : background MP3, or null for none (--no-music)
+    int music_prefetch;        // --music-prefetch MS : decoded music kept ahead of the mixer
+} options = { 0, 600, NULL, NULL, "frame_", NULL, vector<long>(), 0, 0, PACING_VSYNC, 60, 0, 0, ".", BLOOM_HIGH, 0.5f, 1, NULL, 0,
+              NULL, 300 };
+
+Renderer* renderer = NULL;
+
+long frame_count = 0;
+long tick_count = 0;
+vector<ReplayEvent> recorded_events;
+vector<ReplayEvent> replay_events;
+size_t replay_next = 0;
+double replay_cursor_x = 0, replay_cursor_y = 0;
+
+/* The game logic runs in fixed steps of TICK seconds, independent of the frame rate */
+static const double TICK = 1.0/60.0;
+static const int MAX_TICKS_PER_FRAME = 8;   // after a long stall, drop time instead of spiralling
+
+/* Game time in seconds, counted in simulation ticks so replays stay deterministic */
+double gameClock ()
+{
+    return tick_count*TICK;
+}
 
-	// Read the Fragment Shader code from the file
-	std::string FragmentShaderCode;
-	std::ifstream FragmentShaderStream(fragment_file_path, std::ios::in);
-	if(FragmentShaderStream.is_open()){
-		std::string Line = "";
-		while(getline(FragmentShaderStream, Line))
-			FragmentShaderCode += "\n" + Line;
-		FragmentShaderStream.close();
-	}
+/* Stereo position of a sound made at world x */
+float soundPan (float x)
+{
+    return max(-1.0f, min(1.0f, x/400.0f));
+}
 
-	GLint Result = GL_FALSE;
-	int InfoLogLength;
-
-	// Compile Vertex Shader
-	printf("Compiling shader : %s\n", vertex_file_path);
-	char const * VertexSourcePointer = VertexShaderCode.c_str();
-	glShaderSource(VertexShaderID, 1, &VertexSourcePointer , NULL);
-	glCompileShader(VertexShaderID);
-
-	// Check Vertex Shader
-	glGetShaderiv(VertexShaderID, GL_COMPILE_STATUS, &Result);
-	glGetShaderiv(VertexShaderID, GL_INFO_LOG_LENGTH, &InfoLogLength);
-	std::vector<char> VertexShaderErrorMessage(InfoLogLength);
-	glGetShaderInfoLog(VertexShaderID, InfoLogLength, NULL, &VertexShaderErrorMessage[0]);
-	fprintf(stdout, "%s\n", &VertexShaderErrorMessage[0]);
-
-	// Compile Fragment Shader
-	printf("Compiling shader : %s\n", fragment_file_path);
-	char const * FragmentSourcePointer = FragmentShaderCode.c_str();
-	glShaderSource(FragmentShaderID, 1, &FragmentSourcePointer , NULL);
-	glCompileShader(FragmentShaderID);
-
-	// Check Fragment Shader
-	glGetShaderiv(FragmentShaderID, GL_COMPILE_STATUS, &Result);
-	glGetShaderiv(FragmentShaderID, GL_INFO_LOG_LENGTH, &InfoLogLength);
-	std::vector<char> FragmentShaderErrorMessage(InfoLogLength);
-	glGetShaderInfoLog(FragmentShaderID, InfoLogLength, NULL, &FragmentShaderErrorMessage[0]);
-	fprintf(stdout, "%s\n", &FragmentShaderErrorMessage[0]);
-
-	// Link the program
-	fprintf(stdout, "Linking program\n");
-	GLuint ProgramID = glCreateProgram();
-	glAttachShader(ProgramID, VertexShaderID);
-	glAttachShader(ProgramID, FragmentShaderID);
-	glLinkProgram(ProgramID);
-
-	// Check the program
-	glGetProgramiv(ProgramID, GL_LINK_STATUS, &Result);
-	glGetProgramiv(ProgramID, GL_INFO_LOG_LENGTH, &InfoLogLength);
-	std::vector<char> ProgramErrorMessage( max(InfoLogLength, int(1)) );
-	glGetProgramInfoLog(ProgramID, InfoLogLength, NULL, &ProgramErrorMessage[0]);
-	fprintf(stdout, "%s\n", &ProgramErrorMessage[0]);
-
-	glDeleteShader(VertexShaderID);
-	glDeleteShader(FragmentShaderID);
-
-	return ProgramID;
+/* Cursor position, taken from the replay when one is playing */
+void getCursorPos (GLFWwindow* window, double* x, double* y)
+{
+    if (options.replay_path || !window) {
+        *x = replay_cursor_x;
+        *y = replay_cursor_y;
+        return;
+    }
+    glfwGetCursorPos(window, x, y);
 }
 
+GLuint programID;
+
 static void error_callback(int error, const char* description)
 {
     fprintf(stderr, "Error: %s\n", description);
 }
 
+/* Sprite group for a createRectangle component name */
+map<string, Sprite>* spriteGroup (const string& component)
+{
+    if(component=="cannon")
+      return &CANNON;
+    else if(component=="bucket")
+      return &BUCKET;
+    else if(component=="brick")
+      return &BRICKS;
+    else if(component=="laser")
+      return &LASER;
+    else if(component=="start")
+      return &START_WINDOW;
+    else if(component=="mirror")
+      return &MIRROR;
+    else if(component=="score")
+      return &TEXT;
+    else if(component=="overlay")
+      return &OVERLAY;
+    else if(component=="particle")
+      return &PARTICLES;
+    return NULL;
+}
+
+/* Drop every sprite and the meshes they hold, while the context is still current */
+void releaseSprites ()
+{
+    map<string, Sprite>* groups[] = { &BUCKET, &CANNON, &BRICKS, &LASER, &START_WINDOW, &MIRROR, &TEXT, &OVERLAY, &PARTICLES };
+    for (size_t i=0; i<sizeof(groups)/sizeof(groups[0]); i++) {
+        for (map<string, Sprite>::iterator it=groups[i]->begin(); it!=groups[i]->end(); it++)
+            meshRelease(it->second.object);
+        groups[i]->clear();
+    }
+}
+
+int quit_requested = 0;
+
+/* Stop after the current frame, so every mode ends through shutdownGame() */
 void quit(GLFWwindow *window)
 {
-    glfwDestroyWindow(window);
-    glfwTerminate();
+    quit_requested = 1;
+    if (window)
+        glfwSetWindowShouldClose(window, GL_TRUE);
+}
+
+/* Tear down and exit; no window with the software renderer */
+void shutdownGame(GLFWwindow *window)
+{
+    audioShutdown();
+    pacingReport(stdout);
+    releaseSprites();
+    if (options.record_path)
+        replaySave(options.record_path, recorded_events);
+    delete renderer;
+    if (window) {
+        glfwDestroyWindow(window);
+        glfwTerminate();
+    }
     exit(EXIT_SUCCESS);
 }
 
@@ -179,54 +225,21 @@ void quit(GLFWwindow *window)
 /* Generate VAO, VBOs and return VAO handle */
 struct VAO* create3DObject (GLenum primitive_mode, int numVertices, const GLfloat* vertex_buffer_data, const GLfloat* color_buffer_data, GLenum fill_mode=GL_FILL)
 {
-    struct VAO* vao = new struct VAO;
-    vao->PrimitiveMode = primitive_mode;
-    vao->NumVertices = numVertices;
-    vao->FillMode = fill_mode;
-
-    // Create Vertex Array Object
-    // Should be done after CreateWindow and before any other GL calls
-    glGenVertexArrays(1, &(vao->VertexArrayID)); // VAO
-    glGenBuffers (1, &(vao->VertexBuffer)); // VBO - vertices
-    glGenBuffers (1, &(vao->ColorBuffer));  // VBO - colors
-
-    glBindVertexArray (vao->VertexArrayID); // Bind the VAO 
-    glBindBuffer (GL_ARRAY_BUFFER, vao->VertexBuffer); // Bind the VBO vertices 
-    glBufferData (GL_ARRAY_BUFFER, 3*numVertices*sizeof(GLfloat), vertex_buffer_data, GL_STATIC_DRAW); // Copy the vertices into VBO
-    glVertexAttribPointer(
-                          0,                  // attribute 0. Vertices
-                          3,                  // size (x,y,z)
-                          GL_FLOAT,           // type
-                          GL_FALSE,           // normalized?
-                          0,                  // stride
-                          (void*)0            // array buffer offset
-                          );
-
-    glBindBuffer (GL_ARRAY_BUFFER, vao->ColorBuffer); // Bind the VBO colors 
-    glBufferData (GL_ARRAY_BUFFER, 3*numVertices*sizeof(GLfloat), color_buffer_data, GL_STATIC_DRAW);  // Copy the vertex colors
-    glVertexAttribPointer(
-                          1,                  // attribute 1. Color
-                          3,                  // size (r,g,b)
-                          GL_FLOAT,           // type
-                          GL_FALSE,           // normalized?
-                          0,                  // stride
-                          (void*)0            // array buffer offset
-                          );
-
-    return vao;
+    // Identical geometry is shared; the software renderer only needs the CPU copies
+    return meshAcquire(primitive_mode, numVertices, vertex_buffer_data, color_buffer_data, fill_mode, renderer->usesGL());
 }
 
 /* Generate VAO, VBOs and return VAO handle - Common Color for all vertices */
 struct VAO* create3DObject (GLenum primitive_mode, int numVertices, const GLfloat* vertex_buffer_data, const GLfloat red, const GLfloat green, const GLfloat blue, GLenum fill_mode=GL_FILL)
 {
-    GLfloat* color_buffer_data = new GLfloat [3*numVertices];
+    vector<GLfloat> color_buffer_data (3*numVertices);
     for (int i=0; i<numVertices; i++) {
         color_buffer_data [3*i] = red;
         color_buffer_data [3*i + 1] = green;
         color_buffer_data [3*i + 2] = blue;
     }
 
-    return create3DObject(primitive_mode, numVertices, vertex_buffer_data, color_buffer_data, fill_mode);
+    return create3DObject(primitive_mode, numVertices, vertex_buffer_data, &color_buffer_data[0], fill_mode);
 }
 
 /* Render the VBOs handled by VAO */
@@ -235,23 +248,49 @@ void draw3DObject (struct VAO* vao)
     // Change the Fill Mode for this object
     glPolygonMode (GL_FRONT_AND_BACK, vao->FillMode);
 
-    // Bind the VAO to use
+    // Bind the VAO to use, it carries the vertex layout and index buffer
     glBindVertexArray (vao->VertexArrayID);
 
-    // Enable Vertex Attribute 0 - 3d Vertices
-    glEnableVertexAttribArray(0);
-    // Bind the VBO to use
-    glBindBuffer(GL_ARRAY_BUFFER, vao->VertexBuffer);
-
-    // Enable Vertex Attribute 1 - Color
-    glEnableVertexAttribArray(1);
-    // Bind the VBO to use
-    glBindBuffer(GL_ARRAY_BUFFER, vao->ColorBuffer);
-
     // Draw the geometry !
-    glDrawArrays(vao->PrimitiveMode, 0, vao->NumVertices); // Starting from vertex 0; 3 vertices total -> 1 triangle
+    glDrawElements(vao->PrimitiveMode, vao->NumIndices, GL_UNSIGNED_SHORT, (void*)0);
 }
 
+/* GL backend - one MVP upload and draw call per object */
+class GLRenderer : public Renderer {
+public:
+    bool usesGL () const { return true; }
+    void setClearColor (float r, float g, float b, float a) { glClearColor(r, g, b, a); }
+    void resize (int width, int height) { glViewport(0, 0, (GLsizei) width, (GLsizei) height); }
+
+    void beginFrame (bool covered)
+    {
+        // clear the color and depth in the frame buffer, or just the depth
+        // when the caller draws over every pixel anyway
+        glClear (covered ? GL_DEPTH_BUFFER_BIT : GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+        // use the loaded shader program
+        glUseProgram (programID);
+    }
+
+    void drawObject (VAO* vao, const glm::mat4& MVP)
+    {
+        glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
+        draw3DObject(vao);
+    }
+
+    void endFrame () {}
+
+    void readPixels (int width, int height, unsigned char* rgba)
+    {
+        glPixelStorei(GL_PACK_ALIGNMENT, 1);
+        glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, rgba);
+    }
+};
+
+/* Profiler scopes, see initProfiler */
+int PROF_FRAME, PROF_SIM, PROF_INPUT, PROF_SCENE, PROF_LASER, PROF_BRICKS, PROF_FX, PROF_BLOOM, PROF_SCORE, PROF_SWAP, PROF_POLL;
+int show_profiler = 0;
+
 /**************************
  * Customizable functions *
  **************************/
@@ -299,7 +338,7 @@ void check_pan(){
 
 void keys()
 {
-    if(key_s==1)
+    if(key_s)
     {
       if(CANNON["cannon_small"].y+5 < 290)
       {
@@ -308,7 +347,7 @@ void keys()
       } 
     }
 
-    if(key_f==1)
+    if(key_f)
     {
         if(CANNON["cannon_small"].y-5 > -250)
         {
@@ -317,7 +356,7 @@ void keys()
         }      
     }
 
-    if(key_a==1)
+    if(key_a)
     {
       if(CANNON["cannon_small"].curr_angle<60-5)
         CANNON["cannon_small"].curr_angle+=5;
@@ -325,7 +364,7 @@ void keys()
         CANNON["cannon_small"].curr_angle = 60;
     }
 
-    if(key_d==1)
+    if(key_d)
     {
       if(CANNON["cannon_small"].curr_angle>-60+5)
         CANNON["cannon_small"].curr_angle-=5;
@@ -333,29 +372,50 @@ void keys()
         CANNON["cannon_small"].curr_angle = -60;             
     }
 
-    if(key_alt==1 && key_left==1)
+    if(key_alt && key_left)
       if(BUCKET["bucket_1"].x -5 > -370)
         BUCKET["bucket_1"].x -= 5;
     
-    if(key_alt==1 && key_right)
+    if(key_alt && key_right)
       if(BUCKET["bucket_1"].x + 5 < 370)
         BUCKET["bucket_1"].x += 5;
 
-    if(key_ctrl==1 && key_left==1)
+    if(key_ctrl && key_left)
       if(BUCKET["bucket_2"].x -5 > -370)
         BUCKET["bucket_2"].x -= 5;
     
-    if(key_ctrl==1 && key_right==1)
+    if(key_ctrl && key_right)
       if(BUCKET["bucket_2"].x + 5 < 370)
         BUCKET["bucket_2"].x += 5;
     return;
 }
-/* Executed when a regular key is pressed/released/held-down */
-/* Prefered for Keyboard events */
-void keyboard (GLFWwindow* window, int key, int scancode, int action, int mods)
+/* Held keys are 1 while down. A press sets 2 and a release inside the same tick
+   turns that into 3, so endTickKeys() can let a quick tap act for one tick */
+int* held_keys[] = { &key_s, &key_f, &key_a, &key_d, &key_ctrl, &key_alt, &key_right, &key_left };
+
+void pressKey (int* key)
+{
+    *key = 2;
+}
+
+void releaseKey (int* key)
+{
+    *key = (*key == 2) ? 3 : 0;
+}
+
+void endTickKeys ()
 {
-     // Function is called first on GLFW_PRESS.
+    for (size_t i=0; i<sizeof(held_keys)/sizeof(held_keys[0]); i++) {
+        if (*held_keys[i] == 2)
+            *held_keys[i] = 1;
+        else if (*held_keys[i] == 3)
+            *held_keys[i] = 0;
+    }
+}
 
+/* Game side of a key event, run by the simulation tick the event falls in */
+void handleKey (GLFWwindow* window, int key, int action, int mods)
+{
     if (action == GLFW_PRESS) {
         switch (key) {
             case GLFW_KEY_P:
@@ -364,16 +424,16 @@ void keyboard (GLFWwindow* window, int key, int scancode, int action, int mods)
               break;
 
             case GLFW_KEY_S:
-              key_s = 1;  
+              pressKey(&key_s);  
               break;
             case GLFW_KEY_F:
-              key_f = 1;
+              pressKey(&key_f);
               break;
             case GLFW_KEY_A:
-              key_a = 1;
+              pressKey(&key_a);
               break;
             case GLFW_KEY_D:
-              key_d = 1;
+              pressKey(&key_d);
               break;
             case GLFW_KEY_N:
               if(bricks_speed < 5)
@@ -390,15 +450,15 @@ void keyboard (GLFWwindow* window, int key, int scancode, int action, int mods)
               break;
 
             case GLFW_KEY_RIGHT_CONTROL:
-              key_ctrl = 1;
+              pressKey(&key_ctrl);
               break;
             
             case GLFW_KEY_RIGHT_ALT:
-              key_alt = 1;
+              pressKey(&key_alt);
               break;
               
             case GLFW_KEY_SPACE:
-              time_curr = glfwGetTime();
+              time_curr = gameClock();
               if(time_curr - prev_click < 1.0f  )
                 break;
               else
@@ -412,6 +472,7 @@ void keyboard (GLFWwindow* window, int key, int scancode, int action, int mods)
                   LASER[current].curr_angle = CANNON["cannon_small"].curr_angle;
                   LASER[current].x = CANNON["cannon_small"].x;
                   LASER[current].y = CANNON["cannon_small"].y;
+                  audioPlay(SOUND_LASER, 0.5f, soundPan(LASER[current].x));
                   break;
                 }
               }
@@ -427,7 +488,7 @@ void keyboard (GLFWwindow* window, int key, int scancode, int action, int mods)
                 break;
             
             case GLFW_KEY_RIGHT:
-                key_right = 1;
+                pressKey(&key_right);
                 if(key_ctrl == 0 && key_alt==0)
                 {
                   x_change+=10;
@@ -436,7 +497,7 @@ void keyboard (GLFWwindow* window, int key, int scancode, int action, int mods)
                 break;
             
             case GLFW_KEY_LEFT:
-                key_left = 1;
+                pressKey(&key_left);
                 if(key_ctrl == 0 && key_alt==0)
                 {
                   x_change-=10;
@@ -444,6 +505,11 @@ void keyboard (GLFWwindow* window, int key, int scancode, int action, int mods)
                 }
                 break;    
             
+            case GLFW_KEY_F3:
+                show_profiler = !show_profiler;
+                profilerEnableGPU(show_profiler && renderer->usesGL());
+                break;
+
             case GLFW_KEY_ESCAPE:
                 quit(window);
                 break;
@@ -459,31 +525,31 @@ void keyboard (GLFWwindow* window, int key, int scancode, int action, int mods)
                 quit(window);
                 break;
             case GLFW_KEY_S:
-              key_s = 0;  
+              releaseKey(&key_s);  
               break;
             case GLFW_KEY_F:
-              key_f = 0;
+              releaseKey(&key_f);
               break;
             case GLFW_KEY_A:
-              key_a = 0;
+              releaseKey(&key_a);
               break;
             case GLFW_KEY_D:
-              key_d = 0;
+              releaseKey(&key_d);
               break;
             case GLFW_KEY_RIGHT_CONTROL:
-              key_ctrl = 0;
+              releaseKey(&key_ctrl);
               break;
             
             case GLFW_KEY_RIGHT_ALT:
-              key_alt = 0;
+              releaseKey(&key_alt);
               break;
               
             case GLFW_KEY_RIGHT:
-              key_right = 0;
+              releaseKey(&key_right);
               break;
               
             case GLFW_KEY_LEFT:
-              key_left = 0;
+              releaseKey(&key_left);
               break;
               break;      
             default:
@@ -493,8 +559,8 @@ void keyboard (GLFWwindow* window, int key, int scancode, int action, int mods)
     }
 }
 
-/* Executed for character input (like in text boxes) */
-void keyboardChar (GLFWwindow* window, unsigned int key)
+/* Game side of character input (like in text boxes) */
+void handleChar (GLFWwindow* window, unsigned int key)
 {
 	switch (key) {
 		case 'Q':
@@ -508,10 +574,11 @@ void keyboardChar (GLFWwindow* window, unsigned int key)
 double mouse_initial_X,mouse_initial_Y,mouse_x,mouse_y;
 int mouse_clicked = 0,right_mouse_clicked=0;
 
-void mouse_release(GLFWwindow* window, int button){ 
+void mouse_release(GLFWwindow* window, int button, double x, double y){ 
     mouse_clicked=0;
     float ratio_zoom = x_zoom/y_zoom;
-    glfwGetCursorPos(window,&mouse_x,&mouse_y);
+    mouse_x = x;
+    mouse_y = y;
     if((mouse_initial_X*ratio_zoom - x_zoom) > (BUCKET["bucket_1"].x -BUCKET["bucket_1"].width*0.5) && (ratio_zoom*mouse_initial_X - x_zoom) < (BUCKET["bucket_1"].x +BUCKET["bucket_1"].width*0.5)
       && (-mouse_initial_Y+y_zoom) > (BUCKET["bucket_1"].y -BUCKET["bucket_1"].height*0.5) && (-mouse_initial_Y+y_zoom) < (BUCKET["bucket_1"].y +BUCKET["bucket_1"].height*0.5))
     {
@@ -552,7 +619,7 @@ void mouse_release(GLFWwindow* window, int button){
         CANNON["cannon_small"].curr_angle = 60;
       if(atan(d2/d1)*180.0f/M_PI < -60)
         CANNON["cannon_small"].curr_angle = -60;
-      time_curr = glfwGetTime();
+      time_curr = gameClock();
       if(time_curr - prev_click < 1.0f  )
         return;
       else
@@ -566,6 +633,7 @@ void mouse_release(GLFWwindow* window, int button){
             LASER[current].curr_angle = CANNON["cannon_small"].curr_angle;
             LASER[current].x = CANNON["cannon_small"].x;
             LASER[current].y = CANNON["cannon_small"].y;
+            audioPlay(SOUND_LASER, 0.5f, soundPan(LASER[current].x));
             return;
           }
       }
@@ -574,14 +642,15 @@ void mouse_release(GLFWwindow* window, int button){
 }
 
 
-/* Executed when a mouse button is pressed/released */
-void mouseButton (GLFWwindow* window, int button, int action, int mods)
+/* Game side of a mouse button event. x,y is where the cursor was when it happened */
+void handleMouseButton (GLFWwindow* window, int button, int action, int mods, double x, double y)
 {
     switch (button) {
         case GLFW_MOUSE_BUTTON_LEFT:
             if (action == GLFW_PRESS) {
                 mouse_clicked=1;
-                glfwGetCursorPos(window,&mouse_initial_X,&mouse_initial_Y);
+                mouse_initial_X = x;
+                mouse_initial_Y = y;
             }
             if (action == GLFW_RELEASE) {
                 if(start == 0)
@@ -589,7 +658,7 @@ void mouseButton (GLFWwindow* window, int button, int action, int mods)
                   start = 1;
                   break;
                 }
-                mouse_release(window,button);
+                mouse_release(window,button,x,y);
             }
             break;
         case GLFW_MOUSE_BUTTON_RIGHT:
@@ -605,6 +674,124 @@ void mouseButton (GLFWwindow* window, int button, int action, int mods)
     }
 }
 
+/* Input from the GLFW callbacks, stamped with glfwGetTime() and queued for the
+   simulation. Callbacks only push; ticks pop everything that happened before
+   their end time, so the game sees the same input order at any frame rate. */
+struct InputEvent {
+    double time;
+    char type;      // same codes as ReplayEvent
+    int code, action, mods;
+    double x,y;
+};
+
+SPSCQueue<InputEvent, 1024> input_queue;
+
+void queueInput (char type, int code, int action, int mods, double x, double y)
+{
+    pacingInputEvent();
+    InputEvent ev = { glfwGetTime(), type, code, action, mods, x, y };
+    if (!input_queue.push(ev))
+        fprintf(stderr, "Input queue full, event dropped\n");
+}
+
+/* Executed when a regular key is pressed/released/held-down */
+/* Prefered for Keyboard events */
+void keyboard (GLFWwindow* window, int key, int scancode, int action, int mods)
+{
+    queueInput('K', key, action, mods, 0, 0);
+}
+
+/* Executed for character input (like in text boxes) */
+void keyboardChar (GLFWwindow* window, unsigned int key)
+{
+    queueInput('C', key, 0, 0, 0, 0);
+}
+
+/* Executed when a mouse button is pressed/released */
+void mouseButton (GLFWwindow* window, int button, int action, int mods)
+{
+    double x, y;
+    glfwGetCursorPos(window, &x, &y);
+    queueInput('B', button, action, mods, x, y);
+}
+
+void mouseScrollCallback (GLFWwindow* window, double xoffset, double yoffset)
+{
+    queueInput('S', 0, 0, 0, xoffset, yoffset);
+}
+
+/* Only installed while recording, so a replay knows where the cursor was,
+   or while measuring latency, so cursor motion is timed like other input */
+void cursorCallback (GLFWwindow* window, double x, double y)
+{
+    queueInput('M', 0, 0, 0, x, y);
+}
+
+/* Apply one input event to the game, recording it against the current tick */
+void dispatchEvent (GLFWwindow* window, char type, int code, int action, int mods, double x, double y)
+{
+    redraw_all = 1;
+    if (options.record_path) {
+        ReplayEvent ev = { tick_count, type, code, action, mods, x, y };
+        recorded_events.push_back(ev);
+    }
+    switch (type) {
+        case 'K':
+            handleKey(window, code, action, mods);
+            break;
+        case 'C':
+            handleChar(window, code);
+            break;
+        case 'B':
+            replay_cursor_x = x;
+            replay_cursor_y = y;
+            handleMouseButton(window, code, action, mods, x, y);
+            break;
+        case 'M':
+            replay_cursor_x = x;
+            replay_cursor_y = y;
+            break;
+        case 'S':
+            mousescroll(window, x, y);
+            break;
+        default:
+            break;
+    }
+}
+
+/* Deliver queued input that arrived before 'until', and replay events for the current tick */
+void dispatchInput (GLFWwindow* window, double until)
+{
+    while (replay_next < replay_events.size() && replay_events[replay_next].tick <= tick_count) {
+        const ReplayEvent& ev = replay_events[replay_next++];
+        dispatchEvent(window, ev.type, ev.code, ev.action, ev.mods, ev.x, ev.y);
+    }
+
+    InputEvent ev;
+    while (input_queue.peek(ev) && ev.time < until) {
+        input_queue.pop(ev);
+        dispatchEvent(window, ev.type, ev.code, ev.action, ev.mods, ev.x, ev.y);
+    }
+}
+
+int fb_width = 600, fb_height = 600;   // current framebuffer size
+int render_width = 600, render_height = 600;   // size the scene is drawn at, see setRenderScale
+
+/* Dynamic resolution: below full scale the scene is drawn into scene_target
+   at render_width x render_height and stretched over the window */
+RenderTarget scene_target = {};
+
+void setRenderScale (float scale)
+{
+  render_width = max(1, (int)(fb_width*scale + 0.5f));
+  render_height = max(1, (int)(fb_height*scale + 0.5f));
+}
+
+void refreshWindow (GLFWwindow* window)
+{
+    redraw_all = 1;
+}
+
 /* Executed when window is resized to 'width' and 'height' */
 /* Modify the bounds of the screen here in glm::ortho or Field of View in glm::Perspective */
 void reshapeWindow (GLFWwindow* window, int width, int height)
@@ -612,12 +799,17 @@ void reshapeWindow (GLFWwindow* window, int width, int height)
     int fbwidth=width, fbheight=height;
     /* With Retina display on Mac OS X, GLFW's FramebufferSize
      is different from WindowSize */
-    glfwGetFramebufferSize(window, &fbwidth, &fbheight);
+    if (window)
+        glfwGetFramebufferSize(window, &fbwidth, &fbheight);
 
 	GLfloat fov = 90.0f;
 
-	// sets the viewport of openGL renderer
-	glViewport (0, 0, (GLsizei) fbwidth, (GLsizei) fbheight);
+	// sets the viewport of the renderer
+	renderer->resize (fbwidth, fbheight);
+	fb_width = fbwidth;
+	fb_height = fbheight;
+	setRenderScale(resolutionScale());
+	redraw_all = 1;
 
 	// set the projection matrix as perspective
 	/* glMatrixMode (GL_PROJECTION);
@@ -636,6 +828,7 @@ VAO *triangle, *rectangle;
 
 
 // Creates the rectangle object used in this sample code
+
 void createRectangle (string name, int tone, COLOR colorA, COLOR colorB, COLOR colorC, COLOR colorD, float x, float y, float height, float width, string component)
 {
     // GL3 accepts only Triangles. Quads are not supported
@@ -678,28 +871,16 @@ void createRectangle (string name, int tone, COLOR colorA, COLOR colorB, COLOR c
     vishsprite.tone=tone;
     vishsprite.curr_angle = 0;
 
-    if(component=="cannon")
-      CANNON[name] = vishsprite;
-    else if(component=="bucket")
-      BUCKET[name] = vishsprite;
-    else if(component=="brick")
-      BRICKS[name] = vishsprite;
-    else if(component=="laser")
-      LASER[name] = vishsprite;
-    else if(component=="start")
-      START_WINDOW[name] = vishsprite;
-    else if(component=="mirror")
-      MIRROR[name] = vishsprite;
-    else if(component=="onesPlace")
-      SCORE1[name] = vishsprite;
-    else if(component=="tensPlace")
-      SCORE2[name] = vishsprite;
-    else if(component=="hundPlace")
-      SCORE3[name] = vishsprite;
-    else if(component=="thoPlace")
-      SCORE4[name] = vishsprite;
-    else if(component=="score")
-      TEXT[name] = vishsprite;
+    map<string, Sprite>* group = spriteGroup(component);
+    if(group == NULL)
+    {
+      meshRelease(rectangle);
+      return;
+    }
+    // Replacing a sprite gives back its reference on the old mesh
+    if(group->count(name))
+      meshRelease((*group)[name].object);
+    (*group)[name] = vishsprite;
 }
 
 
@@ -748,6 +929,7 @@ void check_collision_mirror(Sprite* object_laser)
     if(d1 > -MIRROR[current].width*0.5f && d1 < MIRROR[current].width*0.5f  && d2 > -MIRROR[current].width*0.5f && d2 < MIRROR[current].width*0.5f && abs(d1-d2) <= 5.0f)
     {
       object_laser->curr_angle = 2*MIRROR[current].curr_angle - object_laser->curr_angle;
+      audioPlay(SOUND_BOUNCE, 0.4f, soundPan(MIRROR[current].x));
       return ;
     }
   }
@@ -761,51 +943,6 @@ int check_intersection()
   return 0;
 }
 
-//void setStrokes(char val, int charNo, map<string,Sprite> curChar){
-void setStrokes(char val, map<string,Sprite> &curChar){  
-    curChar["top"].status=0;
-    curChar["bottom"].status=0;
-    curChar["middle"].status=0;
-    curChar["left1"].status=0;
-    curChar["left2"].status=0;
-    curChar["right1"].status=0;
-    curChar["right2"].status=0;
-    curChar["middle1"].status=0;
-    curChar["middle2"].status=0;
-    /*Score["diagonal1"].status=0;
-    Score["diagonal2"].status=0;
-    Score["diagonal3"].status=0;
-    Score["diagonal4"].status=0;
-    */if(val=='0' || val=='2' || val=='3' || val=='5' || val=='6'|| val=='7' || val=='8' || val=='9' || val=='P' || val=='I' || val=='O' || val=='N' || val=='T' || val=='S' || val=='E'){
-        curChar["top"].status=1;
-    }
-    if(val=='2' || val=='3' || val=='4' || val=='5' || val=='6' || val=='8' || val=='9' || val=='P' || val=='S' || val=='Y' || val=='E'){
-        curChar["middle"].status=1;
-    }
-    if(val=='0' || val=='2' || val=='3' || val=='5' || val=='6' || val=='8' || val=='9' || val=='O' || val=='S' || val=='I' || val=='Y' || val=='U' || val=='L' || val=='E' || val=='W'){
-        curChar["bottom"].status=1;
-    }
-    if(val=='0' || val=='4' || val=='5' || val=='6' || val=='8' || val=='9' || val=='P' || val=='O' || val=='N' || val=='S' || val=='Y' || val=='U' || val=='L' || val=='E' || val=='W'){
-        curChar["left1"].status=1;
-    }
-    if(val=='0' || val=='2' || val=='6' || val=='8' || val=='P' || val=='O' || val=='N' || val=='U' || val=='L' || val=='E' || val=='W'){
-        curChar["left2"].status=1;
-    }
-    if(val=='0' || val=='1' || val=='2' || val=='3' || val=='4' || val=='7' || val=='8' || val=='9' || val=='P' || val=='O' || val=='N' || val=='Y' || val=='U' || val=='W'){
-        curChar["right1"].status=1;
-    }
-    if(val=='0' || val=='1' || val=='3' || val=='4' || val=='5' || val=='6' || val=='7' || val=='8' || val=='9' || val=='O' || val=='N' || val=='S' || val=='Y' || val=='U' || val=='W'){
-        curChar["right2"].status=1;
-    }
-    if(val=='I' || val=='T'){
-        curChar["middle1"].status=1;
-    }
-    if(val=='I' || val=='T' || val=='W'){
-        curChar["middle2"].status=1;
-    }
-    //SCORE=curChar;
-}
-
 void setStroke(char val){
     TEXT["top"].status=0;
     TEXT["bottom"].status=0;
@@ -876,22 +1013,399 @@ void setStroke(char val){
 
 COLOR red = {255.0/255.0,51.0/255.0,51.0/255.0};
 COLOR blue = {0,0,1};
+
+/* Particle palette: entries 0-3 are the brick tones, then the laser sparks */
+const int PARTICLE_SPARK = 4;
+double particle_time = 0;   // game time the particles have yet to catch up on
 int time_temp = 1;
 int collision = 0;
 double new_mouse_pos_x,new_mouse_pos_y,mouse_pos_x, mouse_pos_y;
 
-/* Render the scene with openGL */
-/* Edit this function according to your assignment */
-void draw (GLFWwindow* window)
+/* Move the lasers in flight, bouncing off mirrors and retiring those that leave the screen */
+void updateLasers ()
+{
+  for(map<string,Sprite>::iterator it=LASER.begin();it!=LASER.end();it++){
+     string current = it->first; //The name of the current object
+     if(LASER[current].inAir==0)
+        continue;
+     LASER[current].x_speed = 1.0f*cos(LASER[current].curr_angle*M_PI/180.0f);
+     LASER[current].x_speed = 1.0f*sin(LASER[current].curr_angle*M_PI/180.0f);
+     LASER[current].x +=  5.0f*cos(LASER[current].curr_angle*M_PI/180.0f);
+     LASER[current].y +=  5.0f*sin(LASER[current].curr_angle*M_PI/180.0f);
+     check_collision_mirror(&LASER[current]);
+     if(check_laser(LASER[current])) 
+       LASER[current].inAir=0;
+  }
+}
+
+/* Drop new bricks, move the falling ones and score those that hit a laser or a bucket */
+void updateBricks ()
+{
+  int brick_temp = rand()%18;
+  int t = 0;
+  for(map<string,Sprite>::iterator it2=BRICKS.begin();it2!=BRICKS.end();it2++)
+  { 
+      string current = it2->first;
+      if(BRICKS[current].inAir==0 && time_temp%(100-(15*(bricks_speed-1))) ==0 && t==brick_temp)
+      {
+        BRICKS[current].inAir = 1;
+        time_temp = 1;
+      }
+      t++;
+  }
+
+  for(map<string,Sprite>::iterator it2=BRICKS.begin();it2!=BRICKS.end();it2++){
+    string current = it2->first; //The name of the current object
+    if(BRICKS[current].inAir==0)
+        continue;
+
+    if(BRICKS[current].y - bricks_speed > -270)
+      BRICKS[current].y -= bricks_speed;
+    else
+    {
+      BRICKS[current].y = 320;
+      BRICKS[current].inAir = 0;
+    }
+
+    if(check_collision_brick(BRICKS[current])==1)
+    {
+      particlesEmit(BRICKS[current].x, BRICKS[current].y, 40, 150, 0.5f, PARTICLE_SPARK);
+      particlesEmit(BRICKS[current].x, BRICKS[current].y, 60, 80, 1.2f, BRICKS[current].tone);
+      audioPlay(SOUND_HIT, 0.7f, soundPan(BRICKS[current].x));
+      BRICKS[current].inAir = 0;
+      BRICKS[current].y = 310;
+      if(BRICKS[current].tone == 0)
+        playerScore += 10;
+      if((BRICKS[current].tone == 1 || BRICKS[current].tone == 2) && playerScore > 0)
+        playerScore -= 10;
+      if(BRICKS[current].tone == 3)
+        playerScore += 50;
+    }
+    collision = check_intersection();
+    if(BRICKS[current].tone == 1 && BRICKS[current].x < (BUCKET["bucket_2"].x +BUCKET["bucket_2"].width*0.5) 
+    && BRICKS[current].x > (BUCKET["bucket_2"].x - BUCKET["bucket_2"].width*0.5) && BRICKS[current].y == -260 && collision == 0 && playerScore > 0)
+        playerScore -= 10; 
+
+    if(BRICKS[current].tone == 2 && BRICKS[current].x < (BUCKET["bucket_1"].x +BUCKET["bucket_1"].width*0.5) 
+    && BRICKS[current].x > (BUCKET["bucket_1"].x - BUCKET["bucket_1"].width*0.5) && BRICKS[current].y == -260 && collision == 0  && playerScore > 0)
+        playerScore -= 10;
+
+    if(BRICKS[current].tone == 2 && BRICKS[current].x < (BUCKET["bucket_2"].x +BUCKET["bucket_2"].width*0.5) 
+    && BRICKS[current].x > (BUCKET["bucket_2"].x - BUCKET["bucket_2"].width*0.5) && BRICKS[current].y == -260 && collision == 0)
+    {
+      playerScore += 10;
+      particlesEmit(BRICKS[current].x, BRICKS[current].y, 30, 60, 0.8f, BRICKS[current].tone);
+      audioPlay(SOUND_CATCH, 0.6f, soundPan(BRICKS[current].x));
+      BRICKS[current].inAir = 0;
+      BRICKS[current].y = 310;
+      //cout << playerScore << "red" << endl;
+    }
+    if(BRICKS[current].tone == 1 && BRICKS[current].x < (BUCKET["bucket_1"].x +BUCKET["bucket_1"].width*0.5) 
+    && BRICKS[current].x > (BUCKET["bucket_1"].x - BUCKET["bucket_1"].width*0.5) && BRICKS[current].y == -260 && collision == 0)
+    {
+      playerScore += 10;
+      particlesEmit(BRICKS[current].x, BRICKS[current].y, 30, 60, 0.8f, BRICKS[current].tone);
+      audioPlay(SOUND_CATCH, 0.6f, soundPan(BRICKS[current].x));
+      BRICKS[current].inAir = 0;
+      BRICKS[current].y = 320;
+      //cout << playerScore << "blue" << endl;
+    }
+    if(BRICKS[current].tone == 0 && BRICKS[current].x < (BUCKET["bucket_1"].x +BUCKET["bucket_1"].width*0.5) 
+    && BRICKS[current].x > (BUCKET["bucket_1"].x - BUCKET["bucket_1"].width*0.5) && BRICKS[current].y == -260)
+    {
+      gameOver = 1;
+      audioPlay(SOUND_GAME_OVER, 0.8f, 0);
+      //start = 0;
+      break;
+    }
+    if(BRICKS[current].tone == 0 && BRICKS[current].x < (BUCKET["bucket_2"].x +BUCKET["bucket_2"].width*0.5) 
+    && BRICKS[current].x > (BUCKET["bucket_2"].x - BUCKET["bucket_2"].width*0.5) && BRICKS[current].y == -260)
+    {
+      gameOver = 1;
+      audioPlay(SOUND_GAME_OVER, 0.8f, 0);
+      //start = 0;
+      break;
+    }
+  }
+}
+
+/* One fixed step of game logic: input for this tick, held keys, then movement */
+void tick (GLFWwindow* window, double until)
 {
+  {
+    ProfileScope inputScope(PROF_INPUT);
+    dispatchInput(window, until);
+  }
   keys();
   time_temp++;
-  // clear the color and depth in the frame buffer
-  glClear (GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-  // use the loaded shader program
-  // Don't change unless you know what you are doing
-  glUseProgram (programID);
+  if(start == 0)
+  {
+    for(map<string, Sprite>::iterator it=START_WINDOW.begin();it!=START_WINDOW.end();it++)
+    {
+      if(it->second.name == "laser")
+        it->second.x += 5;
+      if(it->second.x > 400)
+        it->second.x = -265;
+    }
+  }
+  else if(gameOver==0)
+  {
+    updateLasers();
+    updateBricks();
+    particle_time += TICK;
+  }
+  endTickKeys();
+  tick_count++;
+  audioAdvance(gameClock());
+}
+
+/* Run the ticks that are due by 'now'. sim_time is the start of the next tick */
+double sim_time = 0;
+
+void simulate (GLFWwindow* window, double now)
+{
+  ProfileScope simScope(PROF_SIM);
+  // After a stall or an idle wait, drop what the ticks can't cover up front,
+  // so the last tick still reaches 'now' and takes the input that woke us
+  if(now - sim_time > MAX_TICKS_PER_FRAME*TICK)
+    sim_time = now - MAX_TICKS_PER_FRAME*TICK;
+  int ticks = 0;
+  while(sim_time + TICK <= now && ticks < MAX_TICKS_PER_FRAME)
+  {
+    sim_time += TICK;
+    tick(window, sim_time);
+    ticks++;
+  }
+  if(now - sim_time > TICK)
+    sim_time = now - TICK;
+}
+
+/* Draw a string with the stroke font used for the banners. size is the glyph height */
+void drawStrokeText (const string& text, float x, float y, float size, const glm::mat4& VP)
+{
+  float scale = size/40.0f; // stroke glyphs are 40 units tall and 30 apart
+  for(size_t i=0;i<text.size();i++)
+  {
+    if(text[i]=='.')
+    {
+      glm::mat4 MVP = VP * glm::translate(glm::vec3(x-8*scale, y-20*scale, 0.0f)) * glm::scale(glm::vec3(scale, scale, 1.0f));
+      renderer->drawObject(OVERLAY["dot"].object, MVP);
+      x += 14*scale;
+      continue;
+    }
+    if(text[i]!=' ')
+    {
+      setStroke(text[i]);
+      for(map<string,Sprite>::iterator it=TEXT.begin();it!=TEXT.end();it++)
+      {
+        if(it->second.status==0)
+          continue;
+        glm::mat4 model = glm::translate(glm::vec3(x, y, 0.0f)) * glm::scale(glm::vec3(scale, scale, 1.0f))
+                        * glm::translate(glm::vec3(it->second.x, it->second.y, 0.0f))
+                        * glm::rotate((float)(it->second.curr_angle*M_PI/180.0f), glm::vec3(0,0,1));
+        renderer->drawObject(it->second.object, VP * model);
+      }
+    }
+    x += 30*scale;
+  }
+}
+
+/* The segment font of the text shader is built from the TEXT stroke sprites,
+   so both renderers draw the same letters: bit i of a glyph mask lights the
+   segment made from TEXT_SEGMENTS[i] */
+const char* TEXT_SEGMENTS[] = { "top", "bottom", "middle", "left1", "left2", "right1", "right2", "middle1", "middle2",
+                                "diagonal1", "diagonal2", "diagonal3", "diagonal4", "diagonal5", "diagonal6", "diagonal7" };
+const int TEXT_DOT = sizeof(TEXT_SEGMENTS)/sizeof(TEXT_SEGMENTS[0]);   // the '.' segment comes last
+
+void initText (GLuint program)
+{
+  TextSegment segments[TEXT_DOT+1];
+  for(int i=0;i<TEXT_DOT;i++)
+  {
+    const Sprite& stroke = TEXT[TEXT_SEGMENTS[i]];
+    // Along the long side of the rectangle, rotated the way drawStrokeText does
+    float angle = stroke.curr_angle*M_PI/180.0f;
+    float half = max(stroke.width, stroke.height)/2;
+    float ux = stroke.width >= stroke.height ? cos(angle) : -sin(angle);
+    float uy = stroke.width >= stroke.height ? sin(angle) : cos(angle);
+    TextSegment segment = { stroke.x - ux*half, stroke.y - uy*half, stroke.x + ux*half, stroke.y + uy*half,
+                            min(stroke.width, stroke.height)/2 };
+    segments[i] = segment;
+  }
+  TextSegment dot = { -9.5f, -20, -6.5f, -20, 1.5f };   // OVERLAY["dot"], where drawStrokeText puts it
+  segments[TEXT_DOT] = dot;
+  textInit(program, segments, TEXT_DOT+1, 40);
+
+  for(int c=33;c<127;c++)
+  {
+    setStroke(c);
+    unsigned int mask = 0;
+    for(int i=0;i<TEXT_DOT;i++)
+      if(TEXT[TEXT_SEGMENTS[i]].status==1)
+        mask |= 1u << i;
+    textSetGlyph(c, mask, 30);
+  }
+  textSetGlyph(' ', 0, 30);
+  textSetGlyph('.', 1u << TEXT_DOT, 14);
+}
+
+/* Text in the stroke font: one instanced draw with the text shader, or the
+   stroke sprites one at a time on the software renderer */
+void drawText (const string& text, float x, float y, float size, const glm::mat4& VP)
+{
+  if(!renderer->usesGL())
+  {
+    drawStrokeText(text, x, y, size, VP);
+    return;
+  }
+  const COLOR& color = TEXT["top"].color;
+  textDraw(text.c_str(), x, y, size, VP, color.r, color.g, color.b);
+  glUseProgram(programID);
+}
+
+/* World space rectangle that changed since the last frame */
+struct Damage {
+  float x0, y0, x1, y1;
+};
+
+/* Does a sprite of bounding radius r at (x,y) reach into the damage? NULL damage means everything */
+bool touchesDamage (const Damage* damage, float x, float y, float r)
+{
+  if(damage == NULL)
+    return true;
+  return x + r >= damage->x0 && x - r <= damage->x1 && y + r >= damage->y0 && y - r <= damage->y1;
+}
+
+/* The start screen, optionally only the sprites that touch 'damage' */
+void drawStartScreen (const glm::mat4& VP, const Damage* damage)
+{
+  for(map<string, Sprite>::iterator it=START_WINDOW.begin();it!=START_WINDOW.end();it++)
+  {
+    string current = it->first;
+    if(!touchesDamage(damage, START_WINDOW[current].x, START_WINDOW[current].y, START_WINDOW[current].radius))
+      continue;
+    glm::mat4 MVP;
+    Matrices.model = glm::mat4(1.0f);
+    glm::mat4 ObjectTransform;
+    glm::mat4 translateObject = glm::translate (glm::vec3(START_WINDOW[current].x, START_WINDOW[current].y, 0.0f)); // glTranslatef
+    ObjectTransform=translateObject;
+    Matrices.model *= ObjectTransform;
+    MVP = VP * Matrices.model; // MVP = p * V * M
+      
+    renderer->drawObject(START_WINDOW[current].object, MVP);
+  } 
+  drawText("WELCOME", -90, 0, 40, VP);
+}
+
+/* The start screen is static apart from the moving laser, so it is kept in
+   its own texture and each frame only the rectangle the laser left and
+   entered is cleared (scissored) and redrawn, then the texture is copied to
+   the window. GLFW has no partial swap, so the copy is a full-screen quad,
+   but that costs far less than redrawing the whole screen. */
+RenderTarget start_cache = {};
+glm::mat4 start_cache_VP;
+Damage start_laser_prev;
+
+void drawStartScreenCached (const glm::mat4& VP)
+{
+  const Sprite& laser = START_WINDOW["laser"];
+  Damage now = { laser.x - laser.radius, laser.y - laser.radius, laser.x + laser.radius, laser.y + laser.radius };
+
+  bool resized = renderTargetResize(&start_cache, render_width, render_height);
+  renderTargetBind(&start_cache, render_width, render_height);
+  if(resized || redraw_all || VP != start_cache_VP)
+  {
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    drawStartScreen(VP, NULL);
+    start_cache_VP = VP;
+  }
+  else
+  {
+    Damage damage = { min(now.x0, start_laser_prev.x0), min(now.y0, start_laser_prev.y0),
+                      max(now.x1, start_laser_prev.x1), max(now.y1, start_laser_prev.y1) };
+    // World to window pixels, with a pixel of slack for rounding
+    glm::vec4 p0 = VP * glm::vec4(damage.x0, damage.y0, 0, 1);
+    glm::vec4 p1 = VP * glm::vec4(damage.x1, damage.y1, 0, 1);
+    int x0 = (int)floor((min(p0.x, p1.x)*0.5f + 0.5f)*render_width) - 1;
+    int y0 = (int)floor((min(p0.y, p1.y)*0.5f + 0.5f)*render_height) - 1;
+    int x1 = (int)ceil((max(p0.x, p1.x)*0.5f + 0.5f)*render_width) + 1;
+    int y1 = (int)ceil((max(p0.y, p1.y)*0.5f + 0.5f)*render_height) + 1;
+
+    glEnable(GL_SCISSOR_TEST);
+    glScissor(x0, y0, x1 - x0, y1 - y0);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    drawStartScreen(VP, &damage);
+    glDisable(GL_SCISSOR_TEST);
+  }
+  start_laser_prev = now;
+  renderTargetBind(NULL, render_width, render_height);
+
+  blitTexture(start_cache.color);
+  glUseProgram(programID);
+}
+
+/* Bricks that are falling */
+void drawBricks (const glm::mat4& VP)
+{
+  for(map<string,Sprite>::iterator it2=BRICKS.begin();it2!=BRICKS.end();it2++){
+    string current = it2->first; //The name of the current object
+    if(BRICKS[current].inAir==0)
+        continue;
+     else
+     {
+        glm::mat4 MVP;  // MVP = Projection * View * Model
+
+        Matrices.model = glm::mat4(1.0f);
+
+        glm::mat4 ObjectTransform;
+        glm::mat4 translateObject = glm::translate (glm::vec3(BRICKS[current].x, BRICKS[current].y, 0.0f)); // glTranslatef
+        ObjectTransform=translateObject;
+        Matrices.model *= ObjectTransform;
+        MVP = VP * Matrices.model; // MVP = p * V * M
+    
+       renderer->drawObject(BRICKS[current].object, MVP);
+     
+
+    }
+  }
+}
+
+/* Lasers in flight, for the scene and again for the bloom pass */
+void drawLasers (const glm::mat4& VP)
+{
+  for(map<string,Sprite>::iterator it=LASER.begin();it!=LASER.end();it++){
+
+     string current = it->first; //The name of the current object
+     if(LASER[current].inAir==0)
+        continue;
+     else
+     {
+        glm::mat4 MVP;  // MVP = Projection * View * Model
+
+        Matrices.model = glm::mat4(1.0f);
+
+        glm::mat4 ObjectTransform;
+        glm::mat4 translateObject = glm::translate (glm::vec3(LASER[current].x, LASER[current].y, 0.0f)); // glTranslatef
+        glm::mat4 rotateObject = glm::rotate((float)(LASER[current].curr_angle*M_PI/180.0f), glm::vec3(0,0,1));  // rotate about vector (1,0,0)
+        ObjectTransform=translateObject*rotateObject;
+        Matrices.model *= ObjectTransform;
+        MVP = VP * Matrices.model; // MVP = p * V * M
+    
+       renderer->drawObject(LASER[current].object, MVP);
+
+    }
+  }
+}
+
+/* Render the scene with openGL */
+/* Edit this function according to your assignment */
+void draw (GLFWwindow* window)
+{
+  ProfileScope sceneScope(PROF_SCENE);
+  // clear the frame buffer and bind the shader program (GL backend). The
+  // cached start screen is a full-screen quad that stands in for the color clear
+  renderer->beginFrame(renderer->usesGL() && start == 0);
 
   // Eye - Location of camera. Don't change unless you are sure!!
   glm::vec3 eye ( 5*cos(camera_rotation_angle*M_PI/180.0f), 0, 5*sin(camera_rotation_angle*M_PI/180.0f) );
@@ -908,14 +1422,14 @@ void draw (GLFWwindow* window)
   // Compute ViewProject matrix as view/camera might not be changed for this frame (basic scenario)
   //  Don't change unless you are sure!!
   glm::mat4 VP = Matrices.projection * Matrices.view;
-  glfwGetCursorPos(window, &new_mouse_pos_x, &new_mouse_pos_y);
+  getCursorPos(window, &new_mouse_pos_x, &new_mouse_pos_y);
   if(right_mouse_clicked==1){
       x_change+=new_mouse_pos_x-mouse_pos_x;
       y_change-=new_mouse_pos_y-mouse_pos_y;
       check_pan();
   }
   Matrices.projection = glm::ortho((float)(-x_zoom/zoom_camera+x_change), (float)(x_zoom/zoom_camera+x_change), (float)(-y_zoom/zoom_camera+y_change), (float)(y_zoom/zoom_camera+y_change), 0.1f, 500.0f);
-  glfwGetCursorPos(window, &mouse_pos_x, &mouse_pos_y); 
+  getCursorPos(window, &mouse_pos_x, &mouse_pos_y); 
   // Send our transformation to the currently bound shader, in the "MVP" uniform
   // For each model you render, since the MVP will be different (at least the M part)
   //  Don't change unless you are sure!!
@@ -930,98 +1444,13 @@ void draw (GLFWwindow* window)
       cout << "Press P Or Click Left Mouse Botton To Start" << endl;
       t1=1;
     }
-    for(map<string, Sprite>::iterator it=START_WINDOW.begin();it!=START_WINDOW.end();it++)
-    {
-      string current = it->first;
-      glm::mat4 MVP;
-      Matrices.model = glm::mat4(1.0f);
-      glm::mat4 ObjectTransform;
-      glm::mat4 translateObject = glm::translate (glm::vec3(START_WINDOW[current].x, START_WINDOW[current].y, 0.0f)); // glTranslatef
-      ObjectTransform=translateObject;
-      Matrices.model *= ObjectTransform;
-      MVP = VP * Matrices.model; // MVP = p * V * M
-        
-      glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-
-      draw3DObject(START_WINDOW[current].object);
-      if(START_WINDOW[current].name == "laser")
-        START_WINDOW[current].x += 5;
-        if(START_WINDOW[current].x > 400)
-          START_WINDOW[current].x = -265; 
-    } 
-    int k;
-    TEXT["diagonal1"].curr_angle = (atan(0.5)*180/M_PI);
-    TEXT["diagonal2"].curr_angle = -(atan(0.5)*180/M_PI);
-    TEXT["diagonal3"].curr_angle = -(atan(0.5)*180/M_PI);
-    TEXT["diagonal4"].curr_angle = (atan(0.5)*180/M_PI);
-    TEXT["diagonal5"].curr_angle = (atan(0.5)*180/M_PI);
-    TEXT["diagonal6"].curr_angle = -(atan(0.5)*180/M_PI);
-    TEXT["diagonal7"].curr_angle = (atan(1)*180/M_PI);
-    for(k=1;k<=7;k++)
-    {
-        float translation;
-        float translation1=0;
-        if(k==1)
-        {
-            setStroke('W');
-            translation=-90;
-        }
-        else if(k==2)
-        {
-            setStroke('E');          
-            translation=-60;
-        }
-        else if(k==3)
-        {
-            setStroke('L');          
-            translation=-30;
-        }
-        else if(k==4)
-        {
-            setStroke('C');          
-            translation=0;
-        }
-        else if(k==5)
-        {
-            setStroke('O');          
-            translation=30;
-        }
-        else if(k==6)
-        {
-            setStroke('M');
-
-            translation=60;
-        }
-        else if(k==7)
-        {
-          setStroke('E');          
-          translation=90;
-        }
-        for(map<string,Sprite>::iterator it=TEXT.begin();it!=TEXT.end();it++){
-            string current = it->first; 
-            if(TEXT[current].status==1)
-            {
-                glm::mat4 MVP;  // MVP = Projection * View * Model
-
-                Matrices.model = glm::mat4(1.0f);
-
-                /* Render your scene */
-                glm::mat4 ObjectTransform;
-                glm::mat4 translateObject = glm::translate (glm::vec3(TEXT[current].x+translation,TEXT[current].y+translation1  ,0.0f)); // glTranslatef
-                glm::mat4 rotateTriangle = glm::rotate((float)((TEXT[current].curr_angle)*M_PI/180.0f), glm::vec3(0,0,1));  // rotate about vector (1,0,0)
-                ObjectTransform=translateObject*rotateTriangle;
-                Matrices.model *= ObjectTransform;
-                MVP = VP * Matrices.model; // MVP = p * V * M
-
-                glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-                draw3DObject(TEXT[current].object);
-            }
-        }
-    }
+    if(renderer->usesGL())
+      drawStartScreenCached(VP);
+    else
+      drawStartScreen(VP, NULL);
   }
   else if(gameOver==0)
   {
-
   // for cannon
     for(map<string,Sprite>::iterator it=CANNON.begin();it!=CANNON.end();it++){
         string current = it->first; //The name of the current object
@@ -1038,9 +1467,7 @@ void draw (GLFWwindow* window)
         Matrices.model *= ObjectTransform;
         MVP = VP * Matrices.model; // MVP = p * V * M
         
-        glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-
-        draw3DObject(CANNON[current].object);
+        renderer->drawObject(CANNON[current].object, MVP);
         //glPopMatrix (); 
     }
     // for buckets 
@@ -1055,157 +1482,31 @@ void draw (GLFWwindow* window)
       Matrices.model *= ObjectTransform;
       MVP = VP * Matrices.model; // MVP = p * V * M
         
-      glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-
-      draw3DObject(BUCKET[current].object);
+      renderer->drawObject(BUCKET[current].object, MVP);
     }
 
     //for laser
-    for(map<string,Sprite>::iterator it=LASER.begin();it!=LASER.end();it++){
-
-       string current = it->first; //The name of the current object
-       if(LASER[current].inAir==0)
-          continue;
-       else
-       {
-          LASER[current].x_speed = 1.0f*cos(LASER[current].curr_angle*M_PI/180.0f);
-          LASER[current].x_speed = 1.0f*sin(LASER[current].curr_angle*M_PI/180.0f);
-          LASER[current].x +=  5.0f*cos(LASER[current].curr_angle*M_PI/180.0f);
-          LASER[current].y +=  5.0f*sin(LASER[current].curr_angle*M_PI/180.0f);
-          check_collision_mirror(&LASER[current]);
-          //cout << temp << endl;
-          /*if(temp!=0)
-            LASER[current].curr_angle = 2*MIRROR[temp].curr_angle - LASER[current].curr_angle;*/
-          if(check_laser(LASER[current])) 
-          {
-            LASER[current].inAir=0;
-            continue;
-          }
-          glm::mat4 MVP;  // MVP = Projection * View * Model
-
-          Matrices.model = glm::mat4(1.0f);
-
-          glm::mat4 ObjectTransform;
-          glm::mat4 translateObject = glm::translate (glm::vec3(LASER[current].x, LASER[current].y, 0.0f)); // glTranslatef
-          glm::mat4 rotateObject = glm::rotate((float)(LASER[current].curr_angle*M_PI/180.0f), glm::vec3(0,0,1));  // rotate about vector (1,0,0)
-          ObjectTransform=translateObject*rotateObject;
-          Matrices.model *= ObjectTransform;
-          MVP = VP * Matrices.model; // MVP = p * V * M
-        
-         glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-
-         draw3DObject(LASER[current].object);
-
-      }
+    {
+      ProfileScope laserScope(PROF_LASER);
+      drawLasers(VP);
     }
     // for bricks
-    int brick_temp = rand()%18;
-    int t = 0;
-    for(map<string,Sprite>::iterator it2=BRICKS.begin();it2!=BRICKS.end();it2++)
-    { 
-        string current = it2->first;
-        if(BRICKS[current].inAir==0 && time_temp%(100-(15*(bricks_speed-1))) ==0 && t==brick_temp)
-        {
-          BRICKS[current].inAir = 1;
-          time_temp = 1;
-        }
-        t++;
+    {
+      ProfileScope brickScope(PROF_BRICKS);
+      drawBricks(VP);
     }
-
-    for(map<string,Sprite>::iterator it2=BRICKS.begin();it2!=BRICKS.end();it2++){
-      string current = it2->first; //The name of the current object
-      if(BRICKS[current].inAir==0)
-          continue;
-       else
-       {
-          if(BRICKS[current].y - bricks_speed > -270)
-            BRICKS[current].y -= bricks_speed;
-          else
-          {
-            BRICKS[current].y = 320;
-            BRICKS[current].inAir = 0;
-          }
-
-          if(check_collision_brick(BRICKS[current])==1)
-          {
-            BRICKS[current].inAir = 0;
-            BRICKS[current].y = 310;
-            if(BRICKS[current].tone == 0)
-              playerScore += 10;
-            if((BRICKS[current].tone == 1 || BRICKS[current].tone == 2) && playerScore > 0)
-              playerScore -= 10;
-            if(BRICKS[current].tone == 3)
-              playerScore += 50;
-          }
-          collision = check_intersection();
-          if(BRICKS[current].tone == 1 && BRICKS[current].x < (BUCKET["bucket_2"].x +BUCKET["bucket_2"].width*0.5) 
-          && BRICKS[current].x > (BUCKET["bucket_2"].x - BUCKET["bucket_2"].width*0.5) && BRICKS[current].y == -260 && collision == 0 && playerScore > 0)
-              playerScore -= 10; 
-
-          if(BRICKS[current].tone == 2 && BRICKS[current].x < (BUCKET["bucket_1"].x +BUCKET["bucket_1"].width*0.5) 
-          && BRICKS[current].x > (BUCKET["bucket_1"].x - BUCKET["bucket_1"].width*0.5) && BRICKS[current].y == -260 && collision == 0  && playerScore > 0)
-              playerScore -= 10;
-
-          if(BRICKS[current].tone == 2 && BRICKS[current].x < (BUCKET["bucket_2"].x +BUCKET["bucket_2"].width*0.5) 
-          && BRICKS[current].x > (BUCKET["bucket_2"].x - BUCKET["bucket_2"].width*0.5) && BRICKS[current].y == -260 && collision == 0)
-          {
-            playerScore += 10;
-            BRICKS[current].inAir = 0;
-            BRICKS[current].y = 310;
-            //cout << playerScore << "red" << endl;
-          }
-          if(BRICKS[current].tone == 1 && BRICKS[current].x < (BUCKET["bucket_1"].x +BUCKET["bucket_1"].width*0.5) 
-          && BRICKS[current].x > (BUCKET["bucket_1"].x - BUCKET["bucket_1"].width*0.5) && BRICKS[current].y == -260 && collision == 0)
-          {
-            playerScore += 10;
-            BRICKS[current].inAir = 0;
-            BRICKS[current].y = 320;
-            //cout << playerScore << "blue" << endl;
-          }
-          if(BRICKS[current].tone == 0 && BRICKS[current].x < (BUCKET["bucket_1"].x +BUCKET["bucket_1"].width*0.5) 
-          && BRICKS[current].x > (BUCKET["bucket_1"].x - BUCKET["bucket_1"].width*0.5) && BRICKS[current].y == -260)
-          {
-            gameOver = 1;
-            //start = 0;
-            break;
-          }
-          if(BRICKS[current].tone == 0 && BRICKS[current].x < (BUCKET["bucket_2"].x +BUCKET["bucket_2"].width*0.5) 
-          && BRICKS[current].x > (BUCKET["bucket_2"].x - BUCKET["bucket_2"].width*0.5) && BRICKS[current].y == -260)
-          {
-            gameOver = 1;
-            //start = 0;
-            break;
-          }
-
-          glm::mat4 MVP;  // MVP = Projection * View * Model
-
-          Matrices.model = glm::mat4(1.0f);
-
-          glm::mat4 ObjectTransform;
-          glm::mat4 translateObject = glm::translate (glm::vec3(BRICKS[current].x, BRICKS[current].y, 0.0f)); // glTranslatef
-          ObjectTransform=translateObject;
-          Matrices.model *= ObjectTransform;
-          MVP = VP * Matrices.model; // MVP = p * V * M
-        
-         glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-
-         draw3DObject(BRICKS[current].object);
-         
-
-      }
+    // sparks and debris, stepped here since on the GPU that is render work
+    {
+      ProfileScope fxScope(PROF_FX);
+      particlesUpdate(particle_time);
+      particle_time = 0;
+      particlesDraw(renderer, VP, 3);
+      if(renderer->usesGL())
+        glUseProgram(programID);
     }
-
     // mirrors
     for(map<string,Sprite>::iterator it=MIRROR.begin();it!=MIRROR.end();it++){
         string current = it->first; //The name of the current object
-        if(current == "mirror_1")
-          MIRROR[current].curr_angle = -20;
-        if(current == "mirror_2")
-          MIRROR[current].curr_angle = 50;
-        if(current == "mirror_3")
-          MIRROR[current].curr_angle = -40;
-        if(current == "mirror_4")
-          MIRROR[current].curr_angle = 30;
         glm::mat4 MVP;  // MVP = Projection * View * Model
 
         Matrices.model = glm::mat4(1.0f);
@@ -1217,57 +1518,29 @@ void draw (GLFWwindow* window)
         Matrices.model *= ObjectTransform;
         MVP = VP * Matrices.model; // MVP = p * V * M
         
-        glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
+        renderer->drawObject(MIRROR[current].object, MVP);
+    }
 
-        draw3DObject(MIRROR[current].object);
+    // laser glow
+    {
+      ProfileScope bloomScope(PROF_BLOOM);
+      bool glowing = false;
+      for(map<string,Sprite>::iterator it=LASER.begin();it!=LASER.end();it++)
+        glowing = glowing || it->second.inAir;
+      if(glowing && bloomBegin(render_width, render_height))
+      {
+        drawLasers(VP);
+        bloomEnd(render_width, render_height);
+        glUseProgram(programID);
+      }
     }
 
     //score
-    for(map<string, Sprite>::iterator it=SCORE1.begin();it!=SCORE1.end();it++)
     {
-      string current = it->first;
-      SCORE1[current].inAir = 0;
-      SCORE2[current].inAir = 0;
-      SCORE3[current].inAir = 0;
-      SCORE4[current].inAir = 0;
-    }
-    char curr_score[7];
-    int tempPlace = 1;
-    //char scoreLabel = '0';
-    int te;
-    for(te=0;te<4;te++){
-        map <string, Sprite> tempMap;
-        if(te==0)
-          tempMap = SCORE1;
-        if(te==1)
-          tempMap = SCORE2;
-        if(te==2)
-          tempMap = SCORE3;
-        if(te==3)
-          tempMap = SCORE4;
-        setStrokes('0'+(playerScore/tempPlace)%10,tempMap);
-        for(map<string,Sprite>::iterator it2=tempMap.begin();it2!=tempMap.end();it2++){
-            if(it2->second.status==0)
-                continue;
-            
-            string current = it2->first;
-
-            glm::mat4 MVP;  // MVP = Projection * View * Model
-            Matrices.model = glm::mat4(1.0f);
-
-            glm::mat4 ObjectTransform;
-            //glm::mat4 translateObject = glm::translate (glm::vec3(base_x+it2->second.x, base_y+it2->second.y, 0.0f)); // glTranslatef
-            glm::mat4 translateObject = glm::translate (glm::vec3(tempMap[current].x, tempMap[current].y, 0.0f)); // glTranslatef
-            ObjectTransform=translateObject;
-            Matrices.model *= ObjectTransform;
-            MVP = VP * Matrices.model; // MVP = p * V * M
-
-            glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-
-            draw3DObject(it2->second.object);
-            //glPopMatrix (); 
-        }
-        tempPlace*=10; //Next character
+      ProfileScope scoreScope(PROF_SCORE);
+      char digits[8];
+      snprintf(digits, sizeof(digits), "%04d", playerScore%10000);
+      drawText(digits, 330, 275, 20, VP);
     }
   } 
   else if(gameOver==1)
@@ -1278,73 +1551,7 @@ void draw (GLFWwindow* window)
       cout << "YOUR FINAL SCORE IS :" << " " << playerScore << endl;
       t2 = 1;
     }
-    int k;
-    for(k=1;k<=8;k++)
-    {
-        float translation;
-        float translation1=0;
-        if(k==1)
-        {
-            setStroke('G');
-            translation=-90;
-        }
-        else if(k==2)
-        {
-            setStroke('A');          
-            translation=-60;
-        }
-        else if(k==3)
-        {
-            setStroke('M');          
-            translation=-30;
-        }
-        else if(k==4)
-        {
-            setStroke('E');          
-            translation=0;
-        }
-        else if(k==5)
-        {
-            setStroke('O');          
-            translation=60;
-        }
-        else if(k==6)
-        {
-            setStroke('V');
-
-            translation=90;
-        }
-        else if(k==7)
-        {
-          setStroke('E');          
-          translation=120;
-        }
-        else if(k==8)
-        {
-          setStroke('R');          
-          translation=150;
-        }
-        for(map<string,Sprite>::iterator it=TEXT.begin();it!=TEXT.end();it++){
-            string current = it->first; 
-            if(TEXT[current].status==1)
-            {
-                glm::mat4 MVP;  // MVP = Projection * View * Model
-
-                Matrices.model = glm::mat4(1.0f);
-
-                /* Render your scene */
-                glm::mat4 ObjectTransform;
-                glm::mat4 translateObject = glm::translate (glm::vec3(TEXT[current].x+translation,TEXT[current].y+translation1  ,0.0f)); // glTranslatef
-                glm::mat4 rotateTriangle = glm::rotate((float)((TEXT[current].curr_angle)*M_PI/180.0f), glm::vec3(0,0,1));  // rotate about vector (1,0,0)
-                ObjectTransform=translateObject*rotateTriangle;
-                Matrices.model *= ObjectTransform;
-                MVP = VP * Matrices.model; // MVP = p * V * M
-
-                glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-                draw3DObject(TEXT[current].object);
-            }
-        }
-    }
+    drawText("GAME OVER", -90, 0, 40, VP);
   } 
 
   //  Don't change unless you are sure!!
@@ -1364,8 +1571,129 @@ void draw (GLFWwindow* window)
   //camera_rotation_angle++; // Simulating camera rotation
 }
 
+void initProfiler ()
+{
+  PROF_FRAME = profilerRegister("FRAME", 0);
+  PROF_SIM = profilerRegister("SIM", 0);
+  PROF_INPUT = profilerRegister("INPUT", 0);
+  PROF_SCENE = profilerRegister("SCENE", 0);
+  PROF_LASER = profilerRegister("LASER", 1);
+  PROF_BRICKS = profilerRegister("FALL", 1);
+  PROF_FX = profilerRegister("FX", 1);
+  PROF_BLOOM = profilerRegister("BLOOM", 1);
+  PROF_SCORE = profilerRegister("SCORE", 1);
+  PROF_SWAP = profilerRegister("SWAP", 0);
+  PROF_POLL = profilerRegister("POLL", 0);
+}
+
+/* Profiler overlay (F3): rolling CPU/GPU ms per scope and a frame time graph.
+   Drawn in fixed screen space so zoom and pan don't move it. */
+void drawProfiler ()
+{
+  glm::mat4 VP = glm::ortho(-400.0f, 400.0f, -300.0f, 300.0f, 0.1f, 500.0f) * Matrices.view;
+  const vector<ProfileStat>& stats = profilerStats();
+  char value[32];
+
+  glm::mat4 panel = glm::translate(glm::vec3(-245.0f, 145.0f, 0.0f)) * glm::scale(glm::vec3(300.0f, 300.0f, 1.0f));
+  renderer->drawObject(OVERLAY["panel"].object, VP * panel);
+
+  drawText("CPU", -290, 280, 10, VP);
+  drawText("GPU", -200, 280, 10, VP);
+  for(size_t i=0;i<stats.size();i++)
+  {
+    float y = 262 - 16*i;
+    drawText(stats[i].label, -385, y, 10, VP);
+    snprintf(value, sizeof(value), "%.2f", profilerAverage(i, 0));
+    drawText(value, -290, y, 10, VP);
+    if(stats[i].gpu && renderer->usesGL())
+    {
+      snprintf(value, sizeof(value), "%.2f", profilerAverage(i, 1));
+      drawText(value, -200, y, 10, VP);
+    }
+  }
+
+  if(pacingLatency() > 0)
+  {
+    float y = 262 - 16*stats.size();
+    drawText("LATENCY", -385, y, 10, VP);
+    snprintf(value, sizeof(value), "%.2f", pacingLatency());
+    drawText(value, -290, y, 10, VP);
+  }
+  if(resolutionScale() < 1)
+  {
+    float y = 262 - 16*(stats.size() + (pacingLatency() > 0));
+    drawText("SCALE", -385, y, 10, VP);
+    snprintf(value, sizeof(value), "%.2f", resolutionScale());
+    drawText(value, -290, y, 10, VP);
+  }
+
+  // Frame time graph, newest on the right, 1 unit per ms
+  for(int n=0;n<PROFILE_HISTORY;n++)
+  {
+    float ms = min(profilerSample(PROF_FRAME, 0, n), 30.0);
+    glm::mat4 bar = glm::translate(glm::vec3(-150.0f - 2*n, 5.0f + ms/2, 0.0f)) * glm::scale(glm::vec3(2.0f, ms, 1.0f));
+    renderer->drawObject(OVERLAY["bar"].object, VP * bar);
+  }
+  glm::mat4 budget = glm::translate(glm::vec3(-270.0f, 5.0f + 16.7f, 0.0f)) * glm::scale(glm::vec3(240.0f, 1.0f, 1.0f));
+  renderer->drawObject(OVERLAY["budget"].object, VP * budget);
+}
+
+/* Draw a frame unless nothing on screen could have changed: the game over
+   screen is static until input arrives, the window is resized or
+   the state changes. The start screen's laser only moves on at
+   START_FRAME_PERIOD, so a kiosk waiting for a player idles between its
+   frames. Returns false when the last presented frame still holds and there
+   is nothing to swap. 'force' always draws (offscreen runs). */
+static const double START_FRAME_PERIOD = 1.0/15;
+int last_screen_state = -1;
+double last_start_frame = 0;
+
+bool renderFrame (GLFWwindow* window, bool force)
+{
+  int state = start | (gameOver << 1);
+  if(state != last_screen_state)
+    redraw_all = 1;
+  last_screen_state = state;
+
+  bool still = gameOver || (start == 0 && gameClock() - last_start_frame < START_FRAME_PERIOD);
+  if(!force && still && !redraw_all && !show_profiler && !right_mouse_clicked)
+    return false;
+  if(start == 0)
+    last_start_frame = gameClock();
+
+  bool scaled = renderer->usesGL() && (render_width != fb_width || render_height != fb_height);
+  if(scaled)
+  {
+    renderTargetResize(&scene_target, render_width, render_height);
+    renderTargetSetFrame(&scene_target);
+  }
+  if(renderer->usesGL())
+    renderTargetBind(NULL, render_width, render_height);
+
+  draw(window);
+
+  // Stretch the reduced scene over the window, overlays are drawn sharp on top
+  if(scaled)
+  {
+    renderTargetSetFrame(NULL);
+    renderTargetBind(NULL, fb_width, fb_height);
+    glClear(GL_DEPTH_BUFFER_BIT);
+    blitTexture(scene_target.color);
+    glUseProgram(programID);
+  }
+  if(show_profiler)
+    drawProfiler();
+  renderer->endFrame();
+  redraw_all = 0;
+  return true;
+}
+
 /* Initialise glfw window, I/O callbacks and the renderer to use */
 /* Nothing to Edit here */
+static const int SHADER_CONTEXTS = 6;    // one per program initGL builds
+GLFWwindow* shader_contexts[SHADER_CONTEXTS];
+int shader_context_count = 0;
+
 GLFWwindow* initGLFW (int width, int height)
 {
     GLFWwindow* window; // window desciptor/handle
@@ -1379,6 +1707,8 @@ GLFWwindow* initGLFW (int width, int height)
     glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
     glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
     glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+    if (options.offscreen)
+        glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
 
     window = glfwCreateWindow(width, height, "Sample OpenGL 3.3 Application", NULL, NULL);
 
@@ -1389,7 +1719,24 @@ GLFWwindow* initGLFW (int width, int height)
 
     glfwMakeContextCurrent(window);
     gladLoadGLLoader((GLADloadproc) glfwGetProcAddress);
-    glfwSwapInterval( 1 );
+
+    /* Without driver side parallel compiles, build shaders on worker threads,
+       each using a hidden window whose context shares objects with this one */
+    if (!GLAD_GL_ARB_parallel_shader_compile) {
+        int count = min(SHADER_CONTEXTS, max(1, (int)thread::hardware_concurrency()));
+        glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+        while (shader_context_count < count) {
+            GLFWwindow* shared = glfwCreateWindow(1, 1, "shader compiler", NULL, window);
+            if (!shared)
+                break;
+            shader_contexts[shader_context_count++] = shared;
+        }
+    }
+    shaderCompilerInit(shader_contexts, shader_context_count);
+
+    pacingInit(options.offscreen ? PACING_UNCAPPED : options.pacing, options.fps, options.late_latch, options.latency);
+    // Offscreen runs keep full resolution so their images don't depend on timing
+    resolutionInit(pacingFramePeriod()*1000.0, options.offscreen ? 1 : options.min_scale);
 
     /* --- register callbacks with GLFW --- */
 
@@ -1399,6 +1746,9 @@ GLFWwindow* initGLFW (int width, int height)
     glfwSetFramebufferSizeCallback(window, reshapeWindow);
     glfwSetWindowSizeCallback(window, reshapeWindow);
 
+    /* Contents lost (window uncovered etc.) while nothing was being drawn */
+    glfwSetWindowRefreshCallback(window, refreshWindow);
+
     /* Register function to handle window close */
     glfwSetWindowCloseCallback(window, quit);
 
@@ -1408,16 +1758,50 @@ GLFWwindow* initGLFW (int width, int height)
 
     /* Register function to handle mouse click */
     glfwSetMouseButtonCallback(window, mouseButton);  // mouse button clicks
-    glfwSetScrollCallback(window, mousescroll); // mouse scroll
+    glfwSetScrollCallback(window, mouseScrollCallback); // mouse scroll
+
+    /* Cursor motion only matters to a replay or the latency numbers */
+    if (options.record_path || options.latency)
+        glfwSetCursorPosCallback(window, cursorCallback);
 
 
     return window;
 }
 
+/* Let builds whose shaders have compiled issue their links, so the links
+   overlap the rest of setup instead of queueing up in finishProgram */
+static void pollShaderBuilds (ShaderBuild** builds, int count)
+{
+    for (int i=0; i<count; i++)
+        if (builds[i])
+            programReady(builds[i]);
+}
+
 /* Initialize the OpenGL rendering properties */
 /* Add all the models to be created here */
 void initGL (GLFWwindow* window, int width, int height)
 {
+    // Start the shader builds first, they compile while the models below are created
+    ShaderBuild* mainProgram = NULL;
+    ShaderBuild* blitProgram = NULL;
+    ShaderBuild* textProgram = NULL;
+    ShaderBuild* particleUpdateProgram = NULL;
+    ShaderBuild* particleProgram = NULL;
+    ShaderBuild* blurProgram = NULL;
+    if (renderer->usesGL()) {
+        shaderCacheSetDir(options.shader_cache);
+        mainProgram = buildProgramAsync("Sample_GL.vert", "Sample_GL.frag");
+        blitProgram = buildProgramAsync("Blit.vert", "Blit.frag");
+        textProgram = buildProgramAsync("Text.vert", "Text.frag");
+        const char* particleState[] = { "outState", "outInfo" };
+        particleUpdateProgram = buildFeedbackProgramAsync("Particles_update.vert", particleState, 2);
+        particleProgram = buildProgramAsync("Particles.vert", "Sample_GL.frag");
+        if (options.bloom != BLOOM_OFF)
+            blurProgram = buildProgramAsync("Blit.vert", "Blur.frag");
+    }
+    ShaderBuild* builds[] = { mainProgram, blitProgram, textProgram, particleUpdateProgram, particleProgram, blurProgram };
+    const int buildCount = sizeof(builds)/sizeof(builds[0]);
+
     /* Objects should be created before any other gl function and shaders */
 	// Create the models
 
@@ -1447,6 +1831,11 @@ void initGL (GLFWwindow* window, int width, int height)
   createRectangle("mirror_2",10000,black,black,black,black,-150,-50,3,60,"mirror");
   createRectangle("mirror_3",10000,black,black,black,black,200,100,3,60,"mirror");
   createRectangle("mirror_4",10000,black,black,black,black,200,-100,3,60,"mirror");
+  MIRROR["mirror_1"].curr_angle = -20;
+  MIRROR["mirror_2"].curr_angle = 50;
+  MIRROR["mirror_3"].curr_angle = -40;
+  MIRROR["mirror_4"].curr_angle = 30;
+  pollShaderBuilds(builds, buildCount);
 
   
   createRectangle("laser_1",10000,red,red,red,red,LASER["laser_1"].x,LASER["laser_1"].y,5,40,"laser");
@@ -1474,44 +1863,9 @@ void initGL (GLFWwindow* window, int width, int height)
   createRectangle("brick_D",0,black,black,black,black,50,310,20,20,"brick");
   createRectangle("brick_E",0,black,black,black,black,240,310,20,20,"brick");
   createRectangle("brick_F",0,black,black,black,black,330,310,20,20,"brick");
+  pollShaderBuilds(builds, buildCount);
 
 
-  int t;
-  string temp;
-  int offset=0;
-  int x = -45;
-  for(t=0;t<4;t++)
-  {
-      if(t==0)
-      {
-        offset = 0;
-        temp = "onesPlace";
-      }
-      else if(t==1)
-      {
-        offset = -15;
-        temp = "tensPlace";
-      }
-      else if(t==2)
-      {
-        offset = -30;
-        temp = "hundPlace";
-      }
-      else if(t==3)
-      {
-        offset = -45;
-        temp = "thoPlace";
-      }
-      createRectangle("right1",100,black,black,black,black,380+offset,280,10,2,temp);
-      createRectangle("right2",100,black,black,black,black,380+offset,269,10,2,temp);
-      createRectangle("top",100,black,black,black,black,375+offset,286,2,10,temp);
-      createRectangle("middle",100,black,black,black,black,375+offset,276,2,10,temp);
-      createRectangle("bottom",100,black,black,black,black,375+offset,264,2,10,temp);
-      createRectangle("left1",100,black,black,black,black,370+offset,280,10,2,temp);
-      createRectangle("left2",100,black,black,black,black,370+offset,269,10,2,temp);
-      createRectangle("middle1",100,black,black,black,black,375+offset,280,10,2,temp);
-      createRectangle("middle2",100,black,black,black,black,375+offset,269,10,2,temp);
-  }
     int height1 = 2;
     int width1 = 20;
     createRectangle("top",0,black,black,black,black,0,20,height1,width1,"score");
@@ -1530,6 +1884,33 @@ void initGL (GLFWwindow* window, int width, int height)
     createRectangle("diagonal5",0,black,black,black,black,-5/2,-10,sqrt(5)*width1/2,height1,"score");
     createRectangle("diagonal6",0,black,black,black,black,5/2,-10,sqrt(5)*width1/2,height1,"score");
     createRectangle("diagonal7",0,black,black,black,black,0,-10,sqrt(2)*width1,height1,"score");
+    TEXT["diagonal1"].curr_angle = (atan(0.5)*180/M_PI);
+    TEXT["diagonal2"].curr_angle = -(atan(0.5)*180/M_PI);
+    TEXT["diagonal3"].curr_angle = -(atan(0.5)*180/M_PI);
+    TEXT["diagonal4"].curr_angle = (atan(0.5)*180/M_PI);
+    TEXT["diagonal5"].curr_angle = (atan(0.5)*180/M_PI);
+    TEXT["diagonal6"].curr_angle = -(atan(0.5)*180/M_PI);
+    TEXT["diagonal7"].curr_angle = (atan(1)*180/M_PI);
+    pollShaderBuilds(builds, buildCount);
+
+    // Profiler overlay pieces, unit sized and scaled when drawn
+    COLOR panelgrey = {225/255.0,225/255.0,225/255.0};
+    createRectangle("panel",0,panelgrey,panelgrey,panelgrey,panelgrey,0,0,1,1,"overlay");
+    createRectangle("bar",0,gold,gold,gold,gold,0,0,1,1,"overlay");
+    createRectangle("budget",0,red,red,red,red,0,0,1,1,"overlay");
+    createRectangle("dot",0,black,black,black,black,0,0,3,3,"overlay");
+
+    // Particle quads in the palette colors, for the software renderer
+    COLOR spark = {255/255.0,230/255.0,120/255.0};
+    COLOR particle_colors[] = { black, blue, red, gold, spark };
+    for(int i=0;i<=PARTICLE_SPARK;i++)
+    {
+      char name[16];
+      snprintf(name, sizeof(name), "color_%d", i);
+      const COLOR& c = particle_colors[i];
+      createRectangle(name,0,c,c,c,c,0,0,1,1,"particle");
+      particlesSetColor(i, c.r, c.g, c.b, PARTICLES[name].object);
+    }
  
   /*createRectangle("brick_7",10000,red,red,red,red,300,310,20,20,"brick");
   createRectangle("brick_8",10000,red,red,red,red,350,310,20,20,"brick");
@@ -1546,16 +1927,32 @@ void initGL (GLFWwindow* window, int width, int height)
   */
 
 	
-	// Create and compile our GLSL program from the shaders
-	programID = LoadShaders( "Sample_GL.vert", "Sample_GL.frag" );
-	// Get a handle for our "MVP" uniform
-	Matrices.MatrixID = glGetUniformLocation(programID, "MVP");
+	cout << "MESHES: " << meshCount() << " shared by " << meshReferences() << " sprites" << endl;
 
-	
+	pollShaderBuilds(builds, buildCount);
 	reshapeWindow (window, width, height);
 
     // Background color of the scene
-	glClearColor (123/255.0f,201/255.0f,227/255.0f,0.4f); // R, G, B, A
+	renderer->setClearColor (123/255.0f,201/255.0f,227/255.0f,0.4f); // R, G, B, A
+
+    if (!renderer->usesGL()) {
+        particlesInit(0, 0);
+        return;
+    }
+
+	// Collect the GLSL program started at the top, then stop the compiler thread
+	programID = finishProgram(mainProgram);
+	blitInit(finishProgram(blitProgram));
+	initText(finishProgram(textProgram));
+	GLuint particleUpdate = finishProgram(particleUpdateProgram);
+	particlesInit(particleUpdate, finishProgram(particleProgram));
+	bloomInit(blurProgram ? finishProgram(blurProgram) : 0, options.bloom);
+	shaderCompilerShutdown();
+	while (shader_context_count > 0)
+		glfwDestroyWindow(shader_contexts[--shader_context_count]);
+	// Get a handle for our "MVP" uniform
+	Matrices.MatrixID = glGetUniformLocation(programID, "MVP");
+
 	glClearDepth (1.0f);
 
 	glEnable (GL_DEPTH_TEST);
@@ -1567,32 +1964,217 @@ void initGL (GLFWwindow* window, int width, int height)
     cout << "GLSL: " << glGetString(GL_SHADING_LANGUAGE_VERSION) << endl;
 }
 
+/* Parse command line options. Returns 0 on bad usage */
+int parseOptions (int argc, char** argv)
+{
+    for (int i=1; i<argc; i++) {
+        const char* arg = argv[i];
+        const char* value = (i+1 < argc) ? argv[i+1] : NULL;
+
+        if (!strcmp(arg, "--offscreen"))
+            options.offscreen = 1;
+        else if (!strcmp(arg, "--frames") && value)
+            options.frames = atol(argv[++i]);
+        else if (!strcmp(arg, "--replay") && value)
+            options.replay_path = argv[++i];
+        else if (!strcmp(arg, "--record") && value)
+            options.record_path = argv[++i];
+        else if (!strcmp(arg, "--dump-prefix") && value)
+            options.dump_prefix = argv[++i];
+        else if (!strcmp(arg, "--timings") && value)
+            options.timings_path = argv[++i];
+        else if (!strcmp(arg, "--renderer") && value)
+            options.software = !strcmp(argv[++i], "soft");
+        else if (!strcmp(arg, "--threads") && value)
+            options.threads = atoi(argv[++i]);
+        else if (!strcmp(arg, "--pacing") && value) {
+            const char* mode = argv[++i];
+            options.pacing = !strcmp(mode, "cap") ? PACING_CAP : !strcmp(mode, "uncapped") ? PACING_UNCAPPED : PACING_VSYNC;
+        }
+        else if (!strcmp(arg, "--fps") && value)
+            options.fps = atof(argv[++i]);
+        else if (!strcmp(arg, "--late-latch"))
+            options.late_latch = 1;
+        else if (!strcmp(arg, "--latency"))
+            options.latency = 1;
+        else if (!strcmp(arg, "--shader-cache") && value)
+            options.shader_cache = argv[++i];
+        else if (!strcmp(arg, "--no-shader-cache"))
+            options.shader_cache = NULL;
+        else if (!strcmp(arg, "--no-audio"))
+            options.audio = 0;
+        else if (!strcmp(arg, "--audio-out") && value)
+            options.audio_out = argv[++i];
+        else if (!strcmp(arg, "--bench-mixer"))
+            options.bench_mixer = 1;
+        else if (!strcmp(arg, "--music") && value)
+            options.music = argv[++i];
+        else if (!strcmp(arg, "--no-music"))
+            options.music = NULL;
+        else if (!strcmp(arg, "--music-prefetch") && value)
+            options.music_prefetch = atoi(argv[++i]);
+        else if (!strcmp(arg, "--min-scale") && value)
+            options.min_scale = atof(argv[++i])/100.0f;
+        else if (!strcmp(arg, "--bloom") && value) {
+            const char* quality = argv[++i];
+            options.bloom = !strcmp(quality, "off") ? BLOOM_OFF : !strcmp(quality, "low") ? BLOOM_LOW : BLOOM_HIGH;
+        }
+        else if (!strcmp(arg, "--dump") && value) {
+            char* list = argv[++i];
+            for (char* tok = strtok(list, ","); tok; tok = strtok(NULL, ","))
+                options.dump_frames.push_back(atol(tok));
+        }
+        else {
+            fprintf(stderr, "usage: %s [--offscreen] [--frames N] [--replay FILE] [--record FILE]\n"
+                            "       [--dump F1,F2,...] [--dump-prefix PREFIX] [--timings FILE]\n"
+                            "       [--renderer gl|soft] [--threads N]\n"
+                            "       [--pacing vsync|uncapped|cap] [--fps N] [--late-latch] [--latency]\n"
+                            "       [--shader-cache DIR] [--no-shader-cache] [--bloom off|low|high]\n"
+                            "       [--min-scale PERCENT] [--no-audio] [--audio-out FILE] [--bench-mixer]\n"
+                            "       [--music FILE] [--no-music] [--music-prefetch MS]\n", argv[0]);
+            return 0;
+        }
+    }
+    // The software renderer has no window to present to
+    if (options.software)
+        options.offscreen = 1;
+    return 1;
+}
+
+/* Render a fixed number of frames without presenting, dumping selected ones to PNG */
+void runOffscreen (GLFWwindow* window, int fbwidth, int fbheight)
+{
+    FrameTimings timings;
+    vector<unsigned char> pixels(4*fbwidth*fbheight);
+
+    // Quitting (ESC/Q during a replay) still reports and dumps what was run
+    for (frame_count=0; frame_count<options.frames && !quit_requested; frame_count++) {
+        // One tick per frame; a hidden window gets no live input to wait for
+        {
+            ProfileScope simScope(PROF_SIM);
+            tick(window, HUGE_VAL);
+        }
+
+        // glFinish so the timing covers the GPU work, not just submission
+        double frame_start = profilerNow();
+        renderFrame(window, true);
+        if (renderer->usesGL())
+            glFinish();
+        timings.add((profilerNow() - frame_start)*1000.0);
+        profilerEndCPU(PROF_FRAME, frame_start);
+        profilerEndFrame();
+
+        for (size_t i=0; i<options.dump_frames.size(); i++) {
+            if (options.dump_frames[i] != frame_count)
+                continue;
+            char path[512];
+            snprintf(path, sizeof(path), "%s%05ld.png", options.dump_prefix, frame_count);
+            renderer->readPixels(fbwidth, fbheight, &pixels[0]);
+            writeFramePNG(path, fbwidth, fbheight, &pixels[0]);
+        }
+
+        if (window) {
+            glfwSwapBuffers(window);
+            glfwPollEvents();
+        }
+    }
+
+    timings.report(stdout);
+    if (options.timings_path)
+        timings.writeCSV(options.timings_path);
+}
+
 int main (int argc, char** argv)
 {
 	int width = 600;
 	int height = 600;
   
+  if (!parseOptions(argc, argv))
+      exit(EXIT_FAILURE);
+  if (options.bench_mixer)
+      exit(mixerBenchmark(256, 48000) ? EXIT_SUCCESS : EXIT_FAILURE);
+  if (options.replay_path && !replayLoad(options.replay_path, replay_events))
+      exit(EXIT_FAILURE);
+  initProfiler();
+  if (options.audio_out && !audioInitOffline(options.audio_out, options.music, options.music_prefetch))
+      exit(EXIT_FAILURE);
+
+  if (options.software) {
+      renderer = createSoftwareRenderer(width, height, options.threads);
+      initGL (NULL, width, height);
+      runOffscreen(NULL, width, height);
+      shutdownGame(NULL);
+  }
 
   GLFWwindow* window = initGLFW(width, height);
+  renderer = new GLRenderer();
 
 	initGL (window, width, height);
 
+  if (options.offscreen) {
+      int fbwidth, fbheight;
+      glfwGetFramebufferSize(window, &fbwidth, &fbheight);
+      runOffscreen(window, fbwidth, fbheight);
+      shutdownGame(window);
+  }
+
+  if (options.audio && !options.audio_out)
+      audioInit(options.music, options.music_prefetch);
+
   double last_update_time = glfwGetTime(), current_time;
-  glfwGetCursorPos(window, &mouse_pos_x, &mouse_pos_y);
+  sim_time = last_update_time;
+  bool idle = false;
+  double last_present = 0;
+  const double IDLE_WAIT = 0.5;     // seconds between wake ups while nothing changes
+  getCursorPos(window, &mouse_pos_x, &mouse_pos_y);
 
 
     /* Draw in loop */
     while (!glfwWindowShouldClose(window)) {
+        double frame_start = profilerNow();
+
+        // Wait out the frame budget before sampling input (cap / late latch)
+        pacingBeginFrame();
+
+        // Poll for Keyboard and mouse events. When the last frame was skipped
+        // nothing is animating, so sleep until input (or a periodic wake up)
+        {
+            ProfileScope pollScope(PROF_POLL);
+            if (idle)
+                glfwWaitEventsTimeout(start == 0 ? START_FRAME_PERIOD : IDLE_WAIT);
+            else
+                glfwPollEvents();
+        }
+
+        // Advance the game in fixed ticks, each taking the input stamped before it ends
+        simulate(window, glfwGetTime());
 
         // OpenGL Draw commands
-        
-        draw(window);
+        idle = !renderFrame(window, false);
 
         // Swap Frame Buffer in double buffering
-        glfwSwapBuffers(window);
+        if (!idle) {
+            {
+                ProfileScope swapScope(PROF_SWAP);
+                glfwSwapBuffers(window);
+            }
+            frame_count++;
+            pacingEndFrame();
+
+            // The time between presents drives the dynamic resolution. The
+            // gap after skipped (idle) frames says nothing about load
+            double presented = glfwGetTime();
+            if (last_present > 0)
+                setRenderScale(resolutionUpdate((presented - last_present)*1000.0));
+            last_present = presented;
+        }
+        else {
+            pacingSkipFrame();
+            last_present = 0;
+        }
 
-        // Poll for Keyboard and mouse events
-        glfwPollEvents();
+        profilerEndCPU(PROF_FRAME, frame_start);
+        profilerEndFrame();
 
         // Control based on time (Time based transformation like 5 degrees rotation every 0.5s)
         current_time = glfwGetTime(); // Time in seconds
@@ -1602,6 +2184,5 @@ int main (int argc, char** argv)
         }
     }
 
-    glfwTerminate();
-//    exit(EXIT_SUCCESS);
+    shutdownGame(window);
 }
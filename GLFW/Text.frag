@@ -0,0 +1,30 @@
+#version 330 core
+
+in vec2 local;
+flat in uint segments;
+
+// Segment i is a rectangle centered on segmentLine[i].xy along the unit axis
+// segmentLine[i].zw, with half length / half width segmentSize[i]
+uniform vec4 segmentLine[32];
+uniform vec2 segmentSize[32];
+uniform int segmentCount;
+uniform vec3 textColor;
+
+out vec3 color;
+
+void main()
+{
+    // Signed distance to the nearest lit segment, negative inside
+    float dist = 1e6;
+    for (int i = 0; i < segmentCount; i++) {
+        if ((segments & (1u << uint(i))) == 0u)
+            continue;
+        vec2 p = local - segmentLine[i].xy;
+        vec2 axis = segmentLine[i].zw;
+        vec2 d = abs(vec2(dot(p, axis), dot(p, vec2(-axis.y, axis.x)))) - segmentSize[i];
+        dist = min(dist, max(d.x, d.y));
+    }
+    if (dist > 0.0)
+        discard;
+    color = textColor;
+}
@@ -0,0 +1,19 @@
+#version 330 core
+
+// One quad per character, corners made from the vertex id (triangle strip)
+layout (location = 0) in vec3 glyph;    // per instance : center x, y and scale
+layout (location = 1) in uint mask;     // per instance : lit segments
+
+uniform mat4 VP;
+uniform vec2 extent;    // half size of the glyph quad in glyph units
+
+out vec2 local;
+flat out uint segments;
+
+void main ()
+{
+    vec2 corner = vec2(gl_VertexID & 1, gl_VertexID >> 1)*2.0 - 1.0;
+    local = corner*extent;
+    segments = mask;
+    gl_Position = VP * vec4(glyph.xy + local*glyph.z, 0, 1);
+}
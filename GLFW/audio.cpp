@@ -0,0 +1,336 @@
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#include <ao/ao.h>
+
+#include "audio.h"
+#include "mixer.h"
+#include "music.h"
+#include "samplebank.h"
+#include "spsc_queue.h"
+
+using namespace std;
+
+static const int SAMPLE_RATE = 44100;
+static const int CHANNELS = 2;
+static const int BLOCK_FRAMES = 256;    // per ao_play, about 6 ms
+static const int MAX_VOICES = 64;
+static const float MUSIC_GAIN = 0.35f;  // under the effects
+
+enum CommandType {
+    COMMAND_PLAY,
+    COMMAND_STOP,
+    COMMAND_VOLUME
+};
+
+struct AudioCommand {
+    CommandType type;
+    int voice;          // handle, chosen by the game thread
+    int sound;
+    float gain, pan;    // PLAY: voice gain and pan, VOLUME: master volume in gain
+};
+
+/* A playing sound. handle 0 marks a free slot */
+struct Voice {
+    int handle;
+    Sample sample;
+    size_t position;
+    float left, right;
+};
+
+static ao_device* device = NULL;
+static thread mixer;
+static atomic<bool> mixing(false);
+static SPSCQueue<AudioCommand, 256> commands;
+static int next_handle = 1;                    // game thread
+
+// Mixer thread only (the game thread when offline)
+static Voice voices[MAX_VOICES];
+static float master_volume = 1;
+static vector<float> mix(BLOCK_FRAMES*CHANNELS);
+static vector<short> out(BLOCK_FRAMES*CHANNELS);
+
+// Offline rendering, all on the game thread
+static bool offline = false;
+static const char* offline_path = NULL;
+static long long rendered = 0;          // frames written so far
+static double render_seconds = 0;       // time spent mixing and writing them
+
+/* Fallbacks for missing sound files. Each fills 'out' with mono samples at
+   'rate' from a shape function of time t and progress k (0..1) */
+template <typename Shape>
+static void synthesize (vector<float>& out, int rate, float length, Shape shape)
+{
+    out.resize((size_t)(length*rate));
+    for (size_t i=0; i<out.size(); i++)
+        out[i] = shape((float)i/rate, (float)i/out.size(), 1.0f/rate);
+}
+
+static void synthLaser (vector<float>& out, int rate)
+{
+    // Falling zap: a sweep from 1400 to 300 Hz, softly clipped
+    float phase = 0;
+    synthesize(out, rate, 0.18f, [&](float t, float k, float dt) {
+        phase += 2*M_PI*(1400 - 1100*k)*dt;
+        return tanhf(3*sinf(phase))*0.5f*expf(-4*k);
+    });
+}
+
+static void synthBounce (vector<float>& out, int rate)
+{
+    synthesize(out, rate, 0.06f, [](float t, float k, float dt) {
+        return sinf(2*M_PI*2200*t)*0.6f*expf(-8*k);
+    });
+}
+
+static void synthHit (vector<float>& out, int rate)
+{
+    // Low-passed noise crunch over a short thump
+    unsigned int noise = 22222;
+    float low = 0;
+    synthesize(out, rate, 0.25f, [&](float t, float k, float dt) {
+        noise = noise*1664525u + 1013904223u;
+        low += ((noise >> 8)*(2.0f/16777216.0f) - 1 - low)*0.25f;
+        return (low*0.8f + sinf(2*M_PI*90*t)*0.5f)*expf(-6*k);
+    });
+}
+
+static void synthCatch (vector<float>& out, int rate)
+{
+    // Two rising notes
+    synthesize(out, rate, 0.3f, [](float t, float k, float dt) {
+        return sinf(2*M_PI*(k < 0.5f ? 660 : 990)*t)*0.4f*min(1.0f, (1 - k)*6);
+    });
+}
+
+static void synthGameOver (vector<float>& out, int rate)
+{
+    // Three falling notes, each fading out
+    synthesize(out, rate, 1.2f, [](float t, float k, float dt) {
+        int note = min(2, (int)(k*3));
+        float local = k*3 - note;
+        return sinf(2*M_PI*(392 - 70*note)*t)*0.4f*expf(-3*local)*min(1.0f, (1 - local)*20);
+    });
+}
+
+/* Indexed by Sound, paths relative to the working directory like the shaders */
+static const SampleSource SOURCES[SOUND_COUNT] = {
+    { "sounds/laser", synthLaser },
+    { "sounds/bounce", synthBounce },
+    { "sounds/hit", synthHit },
+    { "sounds/catch", synthCatch },
+    { "sounds/gameover", synthGameOver }
+};
+
+static void apply (const AudioCommand& c)
+{
+    if (c.type == COMMAND_VOLUME) {
+        master_volume = c.gain;
+        return;
+    }
+    if (c.type == COMMAND_STOP) {
+        for (int i=0; i<MAX_VOICES; i++)
+            if (voices[i].handle == c.voice)
+                voices[i].handle = 0;
+        return;
+    }
+
+    // Take a free voice, or steal the one closest to finishing
+    Voice* voice = &voices[0];
+    for (int i=0; i<MAX_VOICES; i++) {
+        if (!voices[i].handle) {
+            voice = &voices[i];
+            break;
+        }
+        if (voices[i].sample.frames - voices[i].position < voice->sample.frames - voice->position)
+            voice = &voices[i];
+    }
+    float angle = (min(1.0f, max(-1.0f, c.pan)) + 1)*M_PI/4;   // equal power pan
+    voice->handle = c.voice;
+    voice->sample = sampleBankGet(c.sound);
+    voice->position = 0;
+    voice->left = c.gain*cos(angle);
+    voice->right = c.gain*sin(angle);
+}
+
+/* Apply the queued commands, then mix 'frames' (up to a block) and hand
+   them to the device. Returns the number of voices still playing */
+static int renderBlock (int frames)
+{
+    AudioCommand c;
+    while (commands.pop(c))
+        apply(c);
+
+    MixVoice block[MAX_VOICES];
+    int count = 0, playing = 0;
+    for (int v=0; v<MAX_VOICES; v++) {
+        Voice& voice = voices[v];
+        if (!voice.handle)
+            continue;
+        MixVoice& m = block[count++];
+        m.samples = voice.sample.data + voice.position;
+        m.frames = min((size_t)frames, voice.sample.frames - voice.position);
+        m.left = voice.left;
+        m.right = voice.right;
+        voice.position += m.frames;
+        if (voice.position >= voice.sample.frames)
+            voice.handle = 0;
+        else
+            playing++;
+    }
+
+    fill(mix.begin(), mix.begin() + frames*CHANNELS, 0.0f);
+    mixVoices(&mix[0], block, count);
+    musicMix(&mix[0], frames, MUSIC_GAIN);
+    mixToInt16(&mix[0], master_volume, &out[0], frames*CHANNELS);
+    ao_play(device, (char*)&out[0], frames*CHANNELS*sizeof(short));
+    return playing;
+}
+
+static void mixerMain ()
+{
+    // ao_play blocks until the device takes the block, which is what paces this thread
+    while (mixing)
+        renderBlock(BLOCK_FRAMES);
+}
+
+static ao_sample_format outputFormat ()
+{
+    ao_sample_format format;
+    memset(&format, 0, sizeof(format));
+    format.bits = 16;
+    format.channels = CHANNELS;
+    format.rate = SAMPLE_RATE;
+    format.byte_format = AO_FMT_NATIVE;
+    format.matrix = (char*)"L,R";
+    return format;
+}
+
+bool audioInit (const char* music, int music_prefetch_ms)
+{
+    ao_initialize();
+    int driver = ao_default_driver_id();
+    if (driver < 0) {
+        fprintf(stderr, "Audio: no default output device, sound is off\n");
+        ao_shutdown();
+        return false;
+    }
+
+    ao_sample_format format = outputFormat();
+    device = ao_open_live(driver, &format, NULL);
+    if (!device) {
+        fprintf(stderr, "Audio: cannot open the output device, sound is off\n");
+        ao_shutdown();
+        return false;
+    }
+
+    sampleBankLoad(SOURCES, SOUND_COUNT, SAMPLE_RATE);
+    if (music)
+        musicOpen(music, SAMPLE_RATE, music_prefetch_ms, true);
+    mixing = true;
+    mixer = thread(mixerMain);
+    return true;
+}
+
+bool audioInitOffline (const char* path, const char* music, int music_prefetch_ms)
+{
+    ao_initialize();
+    bool null = !strcmp(path, "null");
+    const char* extension = strrchr(path, '.');
+    int driver = ao_driver_id(null ? "null" : extension && !strcmp(extension, ".raw") ? "raw" : "wav");
+    ao_sample_format format = outputFormat();
+    device = null ? ao_open_live(driver, &format, NULL) : ao_open_file(driver, path, 1, &format, NULL);
+    if (!device) {
+        fprintf(stderr, "Audio: cannot write %s\n", path);
+        ao_shutdown();
+        return false;
+    }
+
+    sampleBankLoad(SOURCES, SOUND_COUNT, SAMPLE_RATE);
+    if (music)
+        musicOpen(music, SAMPLE_RATE, music_prefetch_ms, false);
+    offline = true;
+    offline_path = path;
+    rendered = 0;
+    render_seconds = 0;
+    return true;
+}
+
+void audioAdvance (double seconds)
+{
+    if (!offline)
+        return;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    long long target = llround(seconds*SAMPLE_RATE);
+    while (rendered < target) {
+        int frames = (int)min((long long)BLOCK_FRAMES, target - rendered);
+        renderBlock(frames);
+        rendered += frames;
+    }
+    render_seconds += chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+/* Play out whatever is still sounding, then report the throughput */
+static void finishOffline ()
+{
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    int playing;
+    do {
+        playing = renderBlock(BLOCK_FRAMES);
+        rendered += BLOCK_FRAMES;
+    } while (playing > 0);
+    render_seconds += chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    double audio_seconds = (double)rendered/SAMPLE_RATE;
+    printf("AUDIO: %.2f s rendered to %s in %.1f ms, %.0fx real time\n", audio_seconds, offline_path,
+           render_seconds*1000, audio_seconds/max(render_seconds, 1e-9));
+    offline = false;
+}
+
+void audioShutdown ()
+{
+    if (!device)
+        return;
+    if (offline)
+        finishOffline();
+    else {
+        mixing = false;
+        mixer.join();
+    }
+    musicClose();
+    ao_close(device);
+    ao_shutdown();
+    sampleBankFree();
+    device = NULL;
+}
+
+int audioPlay (Sound sound, float gain, float pan)
+{
+    if (!device)
+        return 0;
+    AudioCommand c = { COMMAND_PLAY, next_handle, sound, gain, pan };
+    if (!commands.push(c))
+        return 0;
+    return next_handle++;
+}
+
+void audioStop (int voice)
+{
+    if (!device || !voice)
+        return;
+    AudioCommand c = { COMMAND_STOP, voice, 0, 0, 0 };
+    commands.push(c);
+}
+
+void audioSetVolume (float volume)
+{
+    if (!device)
+        return;
+    AudioCommand c = { COMMAND_VOLUME, 0, 0, volume, 0 };
+    commands.push(c);
+}
@@ -0,0 +1,39 @@
+#ifndef AUDIO_H
+#define AUDIO_H
+
+enum Sound {
+    SOUND_LASER,        // cannon fires
+    SOUND_BOUNCE,       // laser reflects off a mirror
+    SOUND_HIT,          // laser hits a brick
+    SOUND_CATCH,        // brick caught in the matching bucket
+    SOUND_GAME_OVER,    // jingle when the game ends
+    SOUND_COUNT
+};
+
+/* Open the default libao live device, load the sounds (sounds/<name>.wav or
+   .mp3, synthesized when missing) and start the mixer thread, which owns
+   the device and is the only thread that ever calls ao_play. music, unless
+   NULL, is an MP3 streamed underneath on repeat (see music.h). Returns
+   false when there is no usable device; every other call is then a no-op. */
+bool audioInit (const char* music, int music_prefetch_ms);
+void audioShutdown ();
+
+/* Offline instead: no mixer thread and no pacing, the game thread mixes
+   as audioAdvance is called and writes through libao's file drivers. A
+   path ending in .raw gets headerless PCM, "null" only mixes (for timing),
+   anything else a WAV file. Commands take effect at the next advance, so
+   the same calls always render the same bytes. */
+bool audioInitOffline (const char* path, const char* music, int music_prefetch_ms);
+
+/* Offline: render up to 'seconds' of game time. Does nothing otherwise */
+void audioAdvance (double seconds);
+
+/* Game thread only. These just push a command onto a lock-free queue for
+   the mixer, so they never block; a command is dropped if the queue is full.
+   pan runs from -1 (left) to 1 (right). audioPlay returns a voice handle for
+   audioStop, or 0 when audio is off. */
+int audioPlay (Sound sound, float gain, float pan);
+void audioStop (int voice);
+void audioSetVolume (float volume);
+
+#endif
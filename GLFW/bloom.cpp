@@ -0,0 +1,119 @@
+#include <algorithm>
+
+#include "bloom.h"
+#include "rendertarget.h"
+
+using namespace std;
+
+static const int MAX_FETCHES = 5;       // matches the arrays in Blur.frag
+static const float STRENGTH = 0.8f;     // how much of the blurred glow is added
+
+/* Half of a normalized binomial kernel, center first. Pascal's triangle
+   rows (the outer taps of row 12 dropped as too small to matter) */
+static const float LOW_KERNEL[] = { 6, 4, 1 };
+static const float HIGH_KERNEL[] = { 924, 792, 495, 220, 66 };
+
+static BloomQuality bloom_quality = BLOOM_OFF;
+static GLuint blur_program = 0;
+static GLuint blur_vao = 0;
+static GLint blur_source = -1, blur_direction = -1;
+static RenderTarget targets[2];
+static float saved_clear[4];
+
+/* Merge neighbouring taps in pairs: sampling between texels i and i+1 at
+   the weighted position makes the bilinear filter return
+   (w_i*t_i + w_i+1*t_i+1)/(w_i + w_i+1), so one fetch does two taps */
+static int linearTaps (const float* kernel, int radius, float* offsets, float* weights)
+{
+    float sum = kernel[0];
+    for (int i=1; i<=radius; i++)
+        sum += 2*kernel[i];
+
+    offsets[0] = 0;
+    weights[0] = kernel[0]/sum;
+    int fetches = 1;
+    for (int i=1; i<=radius; i+=2) {
+        float w1 = kernel[i];
+        float w2 = i+1 <= radius ? kernel[i+1] : 0;
+        offsets[fetches] = (i*w1 + (i+1)*w2)/(w1 + w2);
+        weights[fetches] = (w1 + w2)/sum;
+        fetches++;
+    }
+    return fetches;
+}
+
+void bloomInit (GLuint program, BloomQuality quality)
+{
+    bloom_quality = quality;
+    blur_program = program;
+    if (quality == BLOOM_OFF)
+        return;
+
+    float offsets[MAX_FETCHES] = {}, weights[MAX_FETCHES] = {};
+    int taps;
+    if (quality == BLOOM_LOW)
+        taps = linearTaps(LOW_KERNEL, 2, offsets, weights);
+    else
+        taps = linearTaps(HIGH_KERNEL, 4, offsets, weights);
+
+    glUseProgram(program);
+    glUniform1i(glGetUniformLocation(program, "taps"), taps);
+    glUniform1fv(glGetUniformLocation(program, "offsets"), MAX_FETCHES, offsets);
+    glUniform1fv(glGetUniformLocation(program, "weights"), MAX_FETCHES, weights);
+    blur_source = glGetUniformLocation(program, "source");
+    blur_direction = glGetUniformLocation(program, "direction");
+    if (!blur_vao)
+        glGenVertexArrays(1, &blur_vao);
+}
+
+bool bloomBegin (int fb_width, int fb_height)
+{
+    if (bloom_quality == BLOOM_OFF)
+        return false;
+
+    int divisor = bloom_quality == BLOOM_LOW ? 4 : 2;
+    int width = max(1, fb_width/divisor), height = max(1, fb_height/divisor);
+    renderTargetResize(&targets[0], width, height);
+    renderTargetResize(&targets[1], width, height);
+
+    renderTargetBind(&targets[0], fb_width, fb_height);
+    glGetFloatv(GL_COLOR_CLEAR_VALUE, saved_clear);
+    glClearColor(0, 0, 0, 1);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    glClearColor(saved_clear[0], saved_clear[1], saved_clear[2], saved_clear[3]);
+    return true;
+}
+
+/* One direction of the blur, from source into target */
+static void blurPass (const RenderTarget& source, const RenderTarget& target, float dx, float dy)
+{
+    renderTargetBind(&target, 0, 0);
+    glBindTexture(GL_TEXTURE_2D, source.color);
+    glUniform2f(blur_direction, dx, dy);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+}
+
+void bloomEnd (int fb_width, int fb_height)
+{
+    GLboolean depth_test = glIsEnabled(GL_DEPTH_TEST);
+    glDisable(GL_DEPTH_TEST);
+
+    glUseProgram(blur_program);
+    glActiveTexture(GL_TEXTURE0);
+    glUniform1i(blur_source, 0);
+    glBindVertexArray(blur_vao);
+    glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+    blurPass(targets[0], targets[1], 1.0f/targets[0].width, 0);
+    blurPass(targets[1], targets[0], 0, 1.0f/targets[0].height);
+
+    // Additive composite, scaled by the constant blend color
+    renderTargetBind(NULL, fb_width, fb_height);
+    glEnable(GL_BLEND);
+    glBlendColor(STRENGTH, STRENGTH, STRENGTH, 1);
+    glBlendFunc(GL_CONSTANT_COLOR, GL_ONE);
+    blitTexture(targets[0].color);
+    glDisable(GL_BLEND);
+
+    if (depth_test)
+        glEnable(GL_DEPTH_TEST);
+}
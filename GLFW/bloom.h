@@ -0,0 +1,27 @@
+#ifndef BLOOM_H
+#define BLOOM_H
+
+#include <glad/glad.h>
+
+/* Glow around the lasers. The glowing sprites are drawn into a reduced
+   resolution target, blurred with a separable Gaussian that takes two taps
+   per texture fetch (bilinear filtering between texel pairs), and added onto
+   the frame. LOW is quarter resolution with a 5 tap kernel, HIGH half
+   resolution with 9 taps. */
+enum BloomQuality {
+    BLOOM_OFF,
+    BLOOM_LOW,
+    BLOOM_HIGH
+};
+
+/* blur_program is built from Blit.vert/Blur.frag */
+void bloomInit (GLuint blur_program, BloomQuality quality);
+
+/* Bind the bloom target, cleared, for drawing what should glow. Returns
+   false (and binds nothing) when bloom is off */
+bool bloomBegin (int fb_width, int fb_height);
+
+/* Blur what was drawn since bloomBegin and add it onto the window framebuffer */
+void bloomEnd (int fb_width, int fb_height);
+
+#endif
@@ -0,0 +1,187 @@
+#include <cmath>
+#include <cstddef>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "meshes.h"
+
+using namespace std;
+
+/* Everything that makes two meshes interchangeable */
+struct MeshKey {
+    GLenum mode, fill;
+    string data;                // packed vertices then indices, as bytes
+
+    bool operator< (const MeshKey& other) const
+    {
+        if (mode != other.mode)
+            return mode < other.mode;
+        if (fill != other.fill)
+            return fill < other.fill;
+        return data < other.data;
+    }
+};
+
+static map<MeshKey, VAO*> meshes;
+static int references = 0;
+
+/* Two triangles over corners 0-1-2 and 2-3-0, the order createRectangle emits */
+static const GLushort QUAD_INDICES[6] = { 0, 1, 2, 2, 3, 0 };
+static GLuint quad_index_buffer = 0;
+
+static MeshKey makeKey (const VAO* vao)
+{
+    MeshKey key;
+    key.mode = vao->PrimitiveMode;
+    key.fill = vao->FillMode;
+    key.data.assign((const char*)&vao->Vertices[0], vao->Vertices.size()*sizeof(PackedVertex));
+    key.data.append((const char*)&vao->Indices[0], vao->Indices.size()*sizeof(GLushort));
+    return key;
+}
+
+static GLshort packPosition (GLfloat v)
+{
+    float scaled = roundf(v*VERTEX_POSITION_SCALE);
+    return (GLshort)fmaxf(-32768.0f, fminf(32767.0f, scaled));
+}
+
+static GLubyte packColor (GLfloat c)
+{
+    return (GLubyte)lrintf(fmaxf(0.0f, fminf(1.0f, c))*255.0f);
+}
+
+/* Pack the float vertices and merge repeated ones into an index list */
+static void packMesh (VAO* vao, int numVertices, const GLfloat* vertices, const GLfloat* colors)
+{
+    for (int i=0; i<numVertices; i++) {
+        PackedVertex v;
+        v.x = packPosition(vertices[3*i]);
+        v.y = packPosition(vertices[3*i + 1]);
+        for (int c=0; c<3; c++)
+            v.color[c] = packColor(colors[3*i + c]);
+        v.color[3] = 255;
+
+        // Meshes are a handful of vertices, a linear search is fine
+        size_t j = 0;
+        while (j < vao->Vertices.size() && memcmp(&vao->Vertices[j], &v, sizeof(v)) != 0)
+            j++;
+        if (j == vao->Vertices.size())
+            vao->Vertices.push_back(v);
+        vao->Indices.push_back((GLushort)j);
+    }
+    vao->NumVertices = vao->Vertices.size();
+    vao->NumIndices = vao->Indices.size();
+}
+
+static bool isQuad (const VAO* vao)
+{
+    return vao->NumIndices == 6 && memcmp(&vao->Indices[0], QUAD_INDICES, sizeof(QUAD_INDICES)) == 0;
+}
+
+static void uploadMesh (VAO* vao)
+{
+    // Create Vertex Array Object
+    // Should be done after CreateWindow and before any other GL calls
+    glGenVertexArrays(1, &(vao->VertexArrayID)); // VAO
+    glGenBuffers (1, &(vao->VertexBuffer)); // VBO - vertices and colors
+
+    glBindVertexArray (vao->VertexArrayID); // Bind the VAO
+    glBindBuffer (GL_ARRAY_BUFFER, vao->VertexBuffer); // Bind the VBO vertices
+    glBufferData (GL_ARRAY_BUFFER, vao->Vertices.size()*sizeof(PackedVertex), &vao->Vertices[0], GL_STATIC_DRAW);
+    glVertexAttribPointer(
+                          0,                  // attribute 0. Vertices
+                          2,                  // size (x,y)
+                          GL_SHORT,           // type, scaled down in the shader
+                          GL_FALSE,           // normalized?
+                          sizeof(PackedVertex), // stride
+                          (void*)0            // array buffer offset
+                          );
+    glVertexAttribPointer(
+                          1,                  // attribute 1. Color
+                          4,                  // size (r,g,b,a)
+                          GL_UNSIGNED_BYTE,   // type
+                          GL_TRUE,            // normalized?
+                          sizeof(PackedVertex), // stride
+                          (void*)offsetof(PackedVertex, color) // array buffer offset
+                          );
+    glEnableVertexAttribArray(0);
+    glEnableVertexAttribArray(1);
+
+    // Element array binding is VAO state, so quads just point at the shared buffer
+    if (isQuad(vao)) {
+        if (!quad_index_buffer) {
+            glGenBuffers(1, &quad_index_buffer);
+            glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, quad_index_buffer);
+            glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(QUAD_INDICES), QUAD_INDICES, GL_STATIC_DRAW);
+        }
+        else
+            glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, quad_index_buffer);
+    }
+    else {
+        glGenBuffers(1, &vao->IndexBuffer);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, vao->IndexBuffer);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, vao->Indices.size()*sizeof(GLushort), &vao->Indices[0], GL_STATIC_DRAW);
+    }
+    glBindVertexArray(0);
+}
+
+VAO* meshAcquire (GLenum primitive_mode, int numVertices, const GLfloat* vertices, const GLfloat* colors, GLenum fill_mode, bool upload)
+{
+    VAO* vao = new VAO();
+    vao->PrimitiveMode = primitive_mode;
+    vao->FillMode = fill_mode;
+    packMesh(vao, numVertices, vertices, colors);
+
+    MeshKey key = makeKey(vao);
+    references++;
+
+    map<MeshKey, VAO*>::iterator it = meshes.find(key);
+    if (it != meshes.end()) {
+        delete vao;
+        it->second->RefCount++;
+        return it->second;
+    }
+
+    vao->RefCount = 1;
+    if (upload)
+        uploadMesh(vao);
+
+    meshes[key] = vao;
+    return vao;
+}
+
+void meshRelease (VAO* vao)
+{
+    if (!vao)
+        return;
+    references--;
+    if (--vao->RefCount > 0)
+        return;
+
+    meshes.erase(makeKey(vao));
+
+    if (vao->VertexArrayID) {
+        glDeleteBuffers(1, &vao->VertexBuffer);
+        if (vao->IndexBuffer)
+            glDeleteBuffers(1, &vao->IndexBuffer);
+        glDeleteVertexArrays(1, &vao->VertexArrayID);
+    }
+    delete vao;
+
+    if (meshes.empty() && quad_index_buffer) {
+        glDeleteBuffers(1, &quad_index_buffer);
+        quad_index_buffer = 0;
+    }
+}
+
+int meshCount ()
+{
+    return meshes.size();
+}
+
+int meshReferences ()
+{
+    return references;
+}
@@ -0,0 +1,22 @@
+#ifndef MESHES_H
+#define MESHES_H
+
+#include "renderer.h"
+
+/* Shared meshes. Asking for geometry that matches an existing mesh exactly
+   (primitive, fill mode, vertices and colors) returns that mesh with its
+   reference count bumped, so GPU objects grow with distinct shapes rather
+   than with the number of sprites using them. The float input is packed to
+   PackedVertex with repeated vertices merged into indices; rectangles all
+   share one quad index buffer. 'upload' creates the VAO and buffers, without
+   it only the CPU copies are kept (software renderer). */
+VAO* meshAcquire (GLenum primitive_mode, int numVertices, const GLfloat* vertices, const GLfloat* colors, GLenum fill_mode, bool upload);
+
+/* Drop one reference, the GL objects are deleted with the last one */
+void meshRelease (VAO* vao);
+
+/* Distinct meshes alive and the references held on them */
+int meshCount ();
+int meshReferences ();
+
+#endif
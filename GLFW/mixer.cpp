@@ -0,0 +1,191 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "mixer.h"
+
+using namespace std;
+
+void mixVoicesScalar (float* mix, const MixVoice* voices, int count)
+{
+    for (int v=0; v<count; v++) {
+        const MixVoice& voice = voices[v];
+        for (int i=0; i<voice.frames; i++) {
+            mix[2*i] += voice.samples[i]*voice.left;
+            mix[2*i+1] += voice.samples[i]*voice.right;
+        }
+    }
+}
+
+void mixToInt16Scalar (const float* mix, float volume, short* out, int samples)
+{
+    float scale = volume*32767.0f;
+    for (int i=0; i<samples; i++)
+        out[i] = (short)lrintf(min(32767.0f, max(-32768.0f, mix[i]*scale)));
+}
+
+#if defined(__AVX2__)
+
+void mixVoices (float* mix, const MixVoice* voices, int count)
+{
+    for (int v=0; v<count; v++) {
+        const MixVoice& voice = voices[v];
+        const __m256 gain = _mm256_setr_ps(voice.left, voice.right, voice.left, voice.right,
+                                           voice.left, voice.right, voice.left, voice.right);
+        int i = 0;
+        for (; i+8<=voice.frames; i+=8) {
+            // s0..s7 -> s0 s0 .. s3 s3 and s4 s4 .. s7 s7, unpack works within 128 bit lanes
+            __m256 s = _mm256_loadu_ps(voice.samples + i);
+            __m256 lo = _mm256_unpacklo_ps(s, s), hi = _mm256_unpackhi_ps(s, s);
+            __m256 first = _mm256_permute2f128_ps(lo, hi, 0x20), second = _mm256_permute2f128_ps(lo, hi, 0x31);
+            _mm256_storeu_ps(mix + 2*i, _mm256_add_ps(_mm256_loadu_ps(mix + 2*i), _mm256_mul_ps(first, gain)));
+            _mm256_storeu_ps(mix + 2*i + 8, _mm256_add_ps(_mm256_loadu_ps(mix + 2*i + 8), _mm256_mul_ps(second, gain)));
+        }
+        MixVoice rest = { voice.samples + i, voice.frames - i, voice.left, voice.right };
+        mixVoicesScalar(mix + 2*i, &rest, 1);
+    }
+}
+
+void mixToInt16 (const float* mix, float volume, short* out, int samples)
+{
+    const __m256 scale = _mm256_set1_ps(volume*32767.0f);
+    const __m256 high = _mm256_set1_ps(32767.0f), low = _mm256_set1_ps(-32768.0f);
+    int i = 0;
+    for (; i+16<=samples; i+=16) {
+        // Clamp first, out of range floats convert to INT_MIN
+        __m256 a = _mm256_max_ps(low, _mm256_min_ps(high, _mm256_mul_ps(_mm256_loadu_ps(mix + i), scale)));
+        __m256 b = _mm256_max_ps(low, _mm256_min_ps(high, _mm256_mul_ps(_mm256_loadu_ps(mix + i + 8), scale)));
+        __m256i packed = _mm256_packs_epi32(_mm256_cvtps_epi32(a), _mm256_cvtps_epi32(b));
+        // packs interleaves the 128 bit lanes: a0-3 b0-3 a4-7 b4-7
+        _mm256_storeu_si256((__m256i*)(out + i), _mm256_permute4x64_epi64(packed, 0xD8));
+    }
+    mixToInt16Scalar(mix + i, volume, out + i, samples - i);
+}
+
+#elif defined(__SSE2__)
+
+void mixVoices (float* mix, const MixVoice* voices, int count)
+{
+    for (int v=0; v<count; v++) {
+        const MixVoice& voice = voices[v];
+        const __m128 gain = _mm_setr_ps(voice.left, voice.right, voice.left, voice.right);
+        int i = 0;
+        for (; i+4<=voice.frames; i+=4) {
+            __m128 s = _mm_loadu_ps(voice.samples + i);
+            __m128 lo = _mm_unpacklo_ps(s, s), hi = _mm_unpackhi_ps(s, s);
+            _mm_storeu_ps(mix + 2*i, _mm_add_ps(_mm_loadu_ps(mix + 2*i), _mm_mul_ps(lo, gain)));
+            _mm_storeu_ps(mix + 2*i + 4, _mm_add_ps(_mm_loadu_ps(mix + 2*i + 4), _mm_mul_ps(hi, gain)));
+        }
+        MixVoice rest = { voice.samples + i, voice.frames - i, voice.left, voice.right };
+        mixVoicesScalar(mix + 2*i, &rest, 1);
+    }
+}
+
+void mixToInt16 (const float* mix, float volume, short* out, int samples)
+{
+    const __m128 scale = _mm_set1_ps(volume*32767.0f);
+    const __m128 high = _mm_set1_ps(32767.0f), low = _mm_set1_ps(-32768.0f);
+    int i = 0;
+    for (; i+8<=samples; i+=8) {
+        // Clamp first, out of range floats convert to INT_MIN
+        __m128 a = _mm_max_ps(low, _mm_min_ps(high, _mm_mul_ps(_mm_loadu_ps(mix + i), scale)));
+        __m128 b = _mm_max_ps(low, _mm_min_ps(high, _mm_mul_ps(_mm_loadu_ps(mix + i + 4), scale)));
+        _mm_storeu_si128((__m128i*)(out + i), _mm_packs_epi32(_mm_cvtps_epi32(a), _mm_cvtps_epi32(b)));
+    }
+    mixToInt16Scalar(mix + i, volume, out + i, samples - i);
+}
+
+#else
+
+void mixVoices (float* mix, const MixVoice* voices, int count)
+{
+    mixVoicesScalar(mix, voices, count);
+}
+
+void mixToInt16 (const float* mix, float volume, short* out, int samples)
+{
+    mixToInt16Scalar(mix, volume, out, samples);
+}
+
+#endif
+
+static const int BENCH_BLOCK = 256;             // frames, as the audio thread mixes
+static const int BENCH_SOUND = 1 << 16;         // frames of noise each voice plays from
+
+typedef void (*MixFunction) (float*, const MixVoice*, int);
+typedef void (*ConvertFunction) (const float*, float, short*, int);
+
+/* One second of audio, block by block. Every voice starts at its own offset
+   and the last one ends mid-block, to run the tails too */
+static void mixSecond (MixFunction mix_voices, ConvertFunction convert, const vector<float>& sound,
+                       int voices, int rate, vector<short>& out)
+{
+    vector<float> mix(2*BENCH_BLOCK);
+    vector<MixVoice> block(voices);
+    out.resize(2*(size_t)rate);
+    for (int frame=0; frame<rate; frame+=BENCH_BLOCK) {
+        int frames = min(BENCH_BLOCK, rate - frame);
+        for (int v=0; v<voices; v++) {
+            int start = (v*997 + frame) % (BENCH_SOUND - BENCH_BLOCK);
+            float pan = (v % 17)/16.0f;
+            MixVoice voice = { &sound[start], v == voices-1 ? frames/3 : frames, 1 - pan, pan };
+            block[v] = voice;
+        }
+        fill(mix.begin(), mix.end(), 0.0f);
+        mix_voices(&mix[0], &block[0], voices);
+        convert(&mix[0], 1.0f/8, &out[2*frame], 2*frames);
+    }
+}
+
+static double timeSeconds (MixFunction mix_voices, ConvertFunction convert, const vector<float>& sound,
+                           int voices, int rate, vector<short>& out)
+{
+    const int SECONDS = 4;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    for (int s=0; s<SECONDS; s++)
+        mixSecond(mix_voices, convert, sound, voices, rate, out);
+    return chrono::duration<double>(chrono::steady_clock::now() - start).count()/SECONDS;
+}
+
+bool mixerBenchmark (int voices, int rate)
+{
+    // Loud enough noise that many blocks saturate
+    vector<float> sound(BENCH_SOUND);
+    unsigned int seed = 4321;
+    for (size_t i=0; i<sound.size(); i++) {
+        seed = seed*1664525u + 1013904223u;
+        sound[i] = (seed >> 8)*(2.0f/16777216.0f) - 1;
+    }
+
+    // A fused multiply-add in the scalar build can move a sum by one rounding
+    vector<short> reference, simd;
+    mixSecond(mixVoicesScalar, mixToInt16Scalar, sound, voices, rate, reference);
+    mixSecond(mixVoices, mixToInt16, sound, voices, rate, simd);
+    int worst = 0;
+    for (size_t i=0; i<reference.size(); i++)
+        worst = max(worst, abs(reference[i] - simd[i]));
+
+    double scalar_s = timeSeconds(mixVoicesScalar, mixToInt16Scalar, sound, voices, rate, reference);
+    double simd_s = timeSeconds(mixVoices, mixToInt16, sound, voices, rate, simd);
+#if defined(__AVX2__)
+    const char* kernel = "AVX2";
+#elif defined(__SSE2__)
+    const char* kernel = "SSE2";
+#else
+    const char* kernel = "scalar";
+#endif
+    printf("MIXER: %d voices at %d Hz, %s kernel\n", voices, rate, kernel);
+    printf("  scalar %8.3f ms per second of audio, %5.2f%% of a core\n", scalar_s*1000, scalar_s*100);
+    printf("  %-6s %8.3f ms per second of audio, %5.2f%% of a core, %.1fx\n", kernel, simd_s*1000, simd_s*100, scalar_s/simd_s);
+    printf("  largest difference from the scalar reference: %d\n", worst);
+    return worst <= 1;
+}
@@ -0,0 +1,27 @@
+#ifndef MIXER_H
+#define MIXER_H
+
+/* One voice's share of a block: mono samples and the gain of each channel */
+struct MixVoice {
+    const float* samples;
+    int frames;             // may be less than the block when the sound ends
+    float left, right;
+};
+
+/* Add every voice into 'mix', interleaved stereo floats. SSE2 or AVX2 when
+   the build has them, otherwise the scalar reference below. */
+void mixVoices (float* mix, const MixVoice* voices, int count);
+
+/* Scale by volume to int16, rounding to nearest and saturating */
+void mixToInt16 (const float* mix, float volume, short* out, int samples);
+
+/* The plain loops, which the SIMD kernels must match */
+void mixVoicesScalar (float* mix, const MixVoice* voices, int count);
+void mixToInt16Scalar (const float* mix, float volume, short* out, int samples);
+
+/* --bench-mixer: checks the kernels against the scalar reference, then
+   times both mixing 'voices' voices at 'rate' and prints the share of one
+   core each needs. Returns false if the kernels disagree. */
+bool mixerBenchmark (int voices, int rate);
+
+#endif
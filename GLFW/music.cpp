@@ -0,0 +1,159 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <thread>
+
+#include <mpg123.h>
+
+#ifdef __linux__
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#else
+#include <pthread.h>
+#endif
+
+#include "music.h"
+#include "spsc_queue.h"
+
+using namespace std;
+
+static const int DECODE_FRAMES = 4096;      // per mpg123_read, about 90 ms
+static const int PULL_FRAMES = 1024;        // per ring read in musicMix
+
+static mpg123_handle* mh = NULL;
+static SPSCRing<short> ring;
+static bool threaded = false;
+static thread decoder;
+static atomic<bool> decoding(false);
+static atomic<bool> finished(false);        // the track can't be read any further
+static int nap_ms = 1;                      // decoder sleep while the ring is full
+static long underruns = 0;                  // mixer thread
+
+// Decoder thread only (the mixer offline)
+static short decoded[DECODE_FRAMES*2];
+static bool looped_empty = false;
+
+// Mixer thread only
+static short pulled[PULL_FRAMES*2];
+
+/* Decode one chunk into the ring, looping at the end of the track. Returns
+   false when there is no room for a chunk or nothing left to decode */
+static bool decodeChunk ()
+{
+    if (finished || ring.capacity() - ring.size() < sizeof(decoded)/sizeof(short))
+        return false;
+    size_t done = 0;
+    int status = mpg123_read(mh, decoded, sizeof(decoded), &done);
+    ring.write(decoded, done/sizeof(short));
+    if (done)
+        looped_empty = false;
+    if (status == MPG123_DONE) {
+        // Twice at the end without a sample in between: nothing to loop
+        if (looped_empty || mpg123_seek(mh, 0, SEEK_SET) < 0)
+            finished = true;
+        looped_empty = true;
+    }
+    else if (status != MPG123_OK && status != MPG123_NEW_FORMAT)
+        finished = true;
+    return true;
+}
+
+/* Below the game and mixer threads, which must not lose the CPU to it */
+static void lowerPriority ()
+{
+#ifdef __linux__
+    // Each Linux thread has its own nice value
+    setpriority(PRIO_PROCESS, syscall(SYS_gettid), 10);
+#else
+    sched_param param;
+    param.sched_priority = sched_get_priority_min(SCHED_OTHER);
+    pthread_setschedparam(pthread_self(), SCHED_OTHER, &param);
+#endif
+}
+
+static void decoderMain ()
+{
+    lowerPriority();
+    while (decoding)
+        if (!decodeChunk())
+            this_thread::sleep_for(chrono::milliseconds(nap_ms));
+}
+
+bool musicOpen (const char* path, int rate, int prefetch_ms, bool threaded_decode)
+{
+    mpg123_init();
+    int error;
+    mh = mpg123_new(NULL, &error);
+    if (!mh) {
+        mpg123_exit();
+        return false;
+    }
+    mpg123_param(mh, MPG123_ADD_FLAGS, MPG123_QUIET, 0);
+    // mpg123 resamples and makes mono stereo itself
+    mpg123_format_none(mh);
+    mpg123_format(mh, rate, MPG123_STEREO, MPG123_ENC_SIGNED_16);
+    long file_rate;
+    int channels, encoding;
+    if (mpg123_open(mh, path) != MPG123_OK || mpg123_getformat(mh, &file_rate, &channels, &encoding) != MPG123_OK) {
+        fprintf(stderr, "Audio: cannot stream %s, no music\n", path);
+        musicClose();
+        return false;
+    }
+
+    // At least two chunks, so the decoder always has room for the next one
+    ring.allocate(2*max((size_t)prefetch_ms*rate/1000, (size_t)2*DECODE_FRAMES));
+    int ring_ms = ring.capacity()/2*1000/rate;
+    nap_ms = max(1, ring_ms/4);
+    finished = false;
+    looped_empty = false;
+    underruns = 0;
+    threaded = threaded_decode;
+
+    // Start full, then the thread only has to keep up
+    while (decodeChunk())
+        ;
+    if (threaded) {
+        decoding = true;
+        decoder = thread(decoderMain);
+    }
+    printf("MUSIC: %s, %d ms ring (%zu KB)\n", path, ring_ms, ring.capacity()*sizeof(short)/1024);
+    return true;
+}
+
+void musicClose ()
+{
+    if (!mh)
+        return;
+    if (decoding) {
+        decoding = false;
+        decoder.join();
+    }
+    if (underruns)
+        printf("MUSIC: %ld underruns, try a longer --music-prefetch\n", underruns);
+    mpg123_close(mh);
+    mpg123_delete(mh);
+    mpg123_exit();
+    mh = NULL;
+}
+
+void musicMix (float* mix, int frames, float gain)
+{
+    if (!mh)
+        return;
+    float scale = gain/32768.0f;
+    while (frames > 0) {
+        int n = min(frames, PULL_FRAMES);
+        if (!threaded)
+            while (ring.size() < (size_t)n*2 && decodeChunk())
+                ;
+        size_t got = ring.read(pulled, n*2);
+        for (size_t i=0; i<got; i++)
+            mix[i] += pulled[i]*scale;
+        if (got < (size_t)n*2 && !finished)
+            underruns++;
+        mix += n*2;
+        frames -= n;
+    }
+}
@@ -0,0 +1,18 @@
+#ifndef MUSIC_H
+#define MUSIC_H
+
+/* Looping background music, streamed from an MP3 through mpg123 as 16 bit
+   stereo at 'rate'. With 'threaded' a low priority decoder thread keeps a
+   ring of about prefetch_ms topped up; offline, musicMix decodes as it
+   goes instead, so renders stay deterministic. Everything is allocated
+   here, so memory use does not depend on the length of the track.
+   Returns false, with music off, when the file can't be opened. */
+bool musicOpen (const char* path, int rate, int prefetch_ms, bool threaded);
+void musicClose ();
+
+/* Mixer thread: add 'frames' stereo frames of music times gain onto the
+   interleaved mix. Never waits for the decoder: frames it hasn't decoded
+   yet are left silent and counted as an underrun. */
+void musicMix (float* mix, int frames, float gain);
+
+#endif
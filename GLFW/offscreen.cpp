@@ -0,0 +1,63 @@
+#include <algorithm>
+#include <vector>
+
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include "../glfw-master/deps/stb_image_write.h"
+
+#include "offscreen.h"
+
+using namespace std;
+
+bool writeFramePNG (const char* path, int width, int height, const unsigned char* rgba)
+{
+    // GL rows start at the bottom, PNG rows at the top. Alpha is dropped so
+    // images compare equal regardless of the clear alpha.
+    int stride = 3*width;
+    vector<unsigned char> flipped(stride*height);
+    for (int row=0; row<height; row++) {
+        const unsigned char* src = rgba + 4*width*row;
+        unsigned char* dst = &flipped[(height-1-row)*stride];
+        for (int x=0; x<width; x++) {
+            dst[3*x] = src[4*x];
+            dst[3*x + 1] = src[4*x + 1];
+            dst[3*x + 2] = src[4*x + 2];
+        }
+    }
+
+    if (!stbi_write_png(path, width, height, 3, &flipped[0], stride)) {
+        fprintf(stderr, "Offscreen: failed to write %s\n", path);
+        return false;
+    }
+    return true;
+}
+
+void FrameTimings::report (FILE* fp) const
+{
+    if (ms.empty())
+        return;
+
+    vector<double> sorted(ms);
+    sort(sorted.begin(), sorted.end());
+    double total = 0;
+    for (size_t i=0; i<sorted.size(); i++)
+        total += sorted[i];
+
+    fprintf(fp, "frames: %d\n", (int)sorted.size());
+    fprintf(fp, "min: %.3f ms  avg: %.3f ms  p50: %.3f ms  p95: %.3f ms  max: %.3f ms\n",
+            sorted.front(), total/sorted.size(), sorted[sorted.size()/2],
+            sorted[(sorted.size()*95)/100], sorted.back());
+}
+
+bool FrameTimings::writeCSV (const char* path) const
+{
+    FILE* fp = fopen(path, "w");
+    if (!fp) {
+        fprintf(stderr, "Offscreen: cannot write %s\n", path);
+        return false;
+    }
+    fprintf(fp, "frame,ms\n");
+    for (size_t i=0; i<ms.size(); i++)
+        fprintf(fp, "%d,%.4f\n", (int)i, ms[i]);
+    fclose(fp);
+    return true;
+}
@@ -0,0 +1,19 @@
+#ifndef OFFSCREEN_H
+#define OFFSCREEN_H
+
+#include <cstdio>
+#include <vector>
+
+/* Write an RGBA8 frame (bottom row first, as read back from the renderer) to a PNG file */
+bool writeFramePNG (const char* path, int width, int height, const unsigned char* rgba);
+
+/* Per-frame render timings collected during an offscreen run */
+struct FrameTimings {
+    std::vector<double> ms;
+
+    void add (double frame_ms) { ms.push_back(frame_ms); }
+    void report (FILE* fp) const;
+    bool writeCSV (const char* path) const;
+};
+
+#endif
@@ -0,0 +1,172 @@
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <cfloat>
+
+#include <glad/glad.h>
+#include <GLFW/glfw3.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "pacing.h"
+
+using namespace std;
+
+static PacingMode pacing_mode = PACING_VSYNC;
+static double frame_period = 1.0/60.0;
+static int late_latch = 0;
+static int measure_latency = 0;
+
+static double present_target = 0;   // when the next swap should happen
+static double work_start = 0;
+static double predicted_work = 0.004;   // EWMA of latch -> swap call
+static double spin_margin = 0.002;      // how early to stop sleeping and start spinning
+static double pending_input = 0;        // callback time of the oldest unpresented input
+static int idle_stretch = 0;            // frames went by without a present
+
+/* Latency samples: the most recent LATENCY_HISTORY in a ring for the
+   percentile, the whole session only as running totals */
+static const int LATENCY_HISTORY = 1024;
+static double latency_ring[LATENCY_HISTORY];
+static long latency_count = 0;
+static double latency_total = 0, latency_min = DBL_MAX, latency_max = 0;
+
+/* Sleep most of the way, then spin the rest. The margin tracks how late the
+   OS scheduler actually wakes us so the spin stays short. */
+static void waitUntil (double deadline)
+{
+    for (;;) {
+        double now = glfwGetTime();
+        double remaining = deadline - now;
+        if (remaining <= 0)
+            return;
+
+        if (remaining > spin_margin) {
+            double request = remaining - spin_margin;
+            this_thread::sleep_for(chrono::duration<double>(request));
+            double oversleep = glfwGetTime() - now - request;
+            spin_margin = min(0.004, max(0.0005, max(spin_margin*0.99, oversleep*1.5)));
+            continue;
+        }
+
+#if defined(__SSE2__)
+        _mm_pause();
+#endif
+    }
+}
+
+void pacingInit (PacingMode mode, double fps, int latch, int latency)
+{
+    pacing_mode = mode;
+    late_latch = latch;
+    measure_latency = latency;
+    glfwSwapInterval(mode == PACING_VSYNC ? 1 : 0);
+
+    if (mode == PACING_CAP && fps > 0) {
+        frame_period = 1.0/fps;
+    }
+    else {
+        // Under vsync the budget is one refresh of the primary monitor
+        const GLFWvidmode* vidmode = glfwGetVideoMode(glfwGetPrimaryMonitor());
+        frame_period = (vidmode && vidmode->refreshRate > 0) ? 1.0/vidmode->refreshRate : 1.0/60.0;
+    }
+    present_target = glfwGetTime();
+}
+
+void pacingBeginFrame ()
+{
+    double now = glfwGetTime();
+
+    // After frames that were never presented the old target means nothing:
+    // start over so this frame goes out at once instead of spinning to it
+    if (idle_stretch) {
+        present_target = now - frame_period;
+        idle_stretch = 0;
+    }
+
+    if (pacing_mode == PACING_CAP) {
+        present_target += frame_period;
+        if (present_target < now)
+            present_target = now;   // fell behind, don't try to catch up
+    }
+    else if (pacing_mode == PACING_VSYNC) {
+        present_target += frame_period;
+    }
+
+    // Leave just enough time to build and submit the frame
+    if (late_latch && pacing_mode != PACING_UNCAPPED)
+        waitUntil(present_target - predicted_work*1.25 - 0.001);
+
+    work_start = glfwGetTime();
+}
+
+void pacingEndFrame ()
+{
+    double submitted = glfwGetTime();
+    predicted_work = predicted_work*0.9 + (submitted - work_start)*0.1;
+
+    if (pacing_mode == PACING_CAP && !late_latch)
+        waitUntil(present_target);
+
+    if (measure_latency || (late_latch && pacing_mode == PACING_VSYNC)) {
+        // Block until the swap has actually gone through
+        glFinish();
+        double done = glfwGetTime();
+        if (pacing_mode == PACING_VSYNC)
+            present_target = done;
+        if (pending_input > 0) {
+            double ms = (done - pending_input)*1000.0;
+            latency_ring[latency_count % LATENCY_HISTORY] = ms;
+            latency_count++;
+            latency_total += ms;
+            latency_min = min(latency_min, ms);
+            latency_max = max(latency_max, ms);
+            pending_input = 0;
+        }
+    }
+}
+
+void pacingSkipFrame ()
+{
+    idle_stretch = 1;
+}
+
+void pacingInputEvent ()
+{
+    if (pending_input == 0)
+        pending_input = glfwGetTime();
+}
+
+void pacingReport (FILE* fp)
+{
+    if (!latency_count)
+        return;
+
+    int recent = (int)min(latency_count, (long)LATENCY_HISTORY);
+    vector<double> sorted(latency_ring, latency_ring + recent);
+    sort(sorted.begin(), sorted.end());
+
+    fprintf(fp, "input latency (%ld samples): min %.2f ms  avg %.2f ms  p95 %.2f ms (last %d)  max %.2f ms\n",
+            latency_count, latency_min, latency_total/latency_count,
+            sorted[(sorted.size()*95)/100], recent, latency_max);
+}
+
+double pacingLatency ()
+{
+    if (!latency_count)
+        return 0;
+
+    long count = min(latency_count, 32L);
+    double total = 0;
+    for (long i=latency_count-count; i<latency_count; i++)
+        total += latency_ring[i % LATENCY_HISTORY];
+    return total/count;
+}
+
+double pacingFramePeriod ()
+{
+    return frame_period;
+}
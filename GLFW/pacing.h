@@ -0,0 +1,39 @@
+#ifndef PACING_H
+#define PACING_H
+
+#include <cstdio>
+
+enum PacingMode {
+    PACING_VSYNC,       // swap interval 1, the driver blocks on vblank
+    PACING_UNCAPPED,    // swap interval 0, render as fast as possible
+    PACING_CAP          // swap interval 0, sleep+spin to a fixed frame rate
+};
+
+/* Set the swap interval for the current context and reset pacing state.
+   late_latch delays input sampling until just before the frame has to be
+   submitted. measure_latency times callback -> swap completion (adds a
+   glFinish after every swap). */
+void pacingInit (PacingMode mode, double fps, int late_latch, int measure_latency);
+
+/* Call before polling input: waits out the frame budget (cap / late latch) */
+void pacingBeginFrame ();
+
+/* Call right after glfwSwapBuffers */
+void pacingEndFrame ();
+
+/* Call instead when the frame was skipped and nothing was swapped */
+void pacingSkipFrame ();
+
+/* Call for every input event, stamps the oldest input not yet on screen */
+void pacingInputEvent ();
+
+/* Latency statistics, in ms. The p95 is over the most recent samples */
+void pacingReport (FILE* fp);
+
+/* Rolling average input-to-photon latency in ms, 0 if nothing measured */
+double pacingLatency ();
+
+/* Seconds per frame the current mode aims for (a refresh under vsync) */
+double pacingFramePeriod ();
+
+#endif
@@ -0,0 +1,260 @@
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdlib>
+#include <vector>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#define GLM_FORCE_RADIANS
+#include <glm/gtx/transform.hpp>
+
+#include "particles.h"
+
+using namespace std;
+
+static const float GRAVITY = 200.0f;    // units/s^2, debris falls like the bricks do
+
+static bool gpu = false;
+static vector<Particle> pending;        // emitted since the last update
+static int next_slot = 0;               // ring position for the next particle
+static int used = 0;                    // slots that have ever held a particle
+static float active = 0;                // longest remaining life, nothing to do once <= 0
+static unsigned int seed = 12345;
+
+static float palette[PARTICLE_COLORS][3];
+static VAO* palette_quads[PARTICLE_COLORS];
+
+/* GPU path: buffers[current] holds the live state, the update writes the other one */
+static GLuint update_program = 0, draw_program = 0;
+static GLuint buffers[2], update_vaos[2], draw_vaos[2];
+static int current = 0;
+static GLint update_dt = -1, update_gravity = -1;
+static GLint draw_vp = -1, draw_size = -1, draw_palette = -1;
+
+/* CPU path: one array per field so the update runs a full vector at a time */
+static float* cpu_x;
+static float* cpu_y;
+static float* cpu_vx;
+static float* cpu_vy;
+static float* cpu_life;
+static float* cpu_color;
+
+static float randomUnit ()
+{
+    seed = seed*1664525u + 1013904223u;
+    return (seed >> 8)*(1.0f/16777216.0f);
+}
+
+static float* allocArray ()
+{
+    float* p = NULL;
+    if (posix_memalign((void**)&p, 64, sizeof(float)*PARTICLE_CAPACITY))
+        abort();
+    fill(p, p + PARTICLE_CAPACITY, 0.0f);
+    return p;
+}
+
+/* Particle attributes: 0 = x, y, vx, vy and 1 = life, color */
+static void setupAttributes (GLuint vao, GLuint buffer, GLuint divisor)
+{
+    glBindVertexArray(vao);
+    glBindBuffer(GL_ARRAY_BUFFER, buffer);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, sizeof(Particle), (void*)offsetof(Particle, x));
+    glVertexAttribDivisor(0, divisor);
+    glEnableVertexAttribArray(1);
+    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(Particle), (void*)offsetof(Particle, life));
+    glVertexAttribDivisor(1, divisor);
+}
+
+void particlesInit (GLuint update, GLuint draw)
+{
+    gpu = update && draw;
+    if (!gpu) {
+        cpu_x = allocArray();
+        cpu_y = allocArray();
+        cpu_vx = allocArray();
+        cpu_vy = allocArray();
+        cpu_life = allocArray();
+        cpu_color = allocArray();
+        return;
+    }
+
+    update_program = update;
+    draw_program = draw;
+    update_dt = glGetUniformLocation(update, "dt");
+    update_gravity = glGetUniformLocation(update, "gravity");
+    draw_vp = glGetUniformLocation(draw, "VP");
+    draw_size = glGetUniformLocation(draw, "size");
+    draw_palette = glGetUniformLocation(draw, "palette");
+
+    // Zeroed particles have no life left, so untouched slots are never drawn
+    vector<Particle> zero(PARTICLE_CAPACITY, Particle());
+    glGenBuffers(2, buffers);
+    glGenVertexArrays(2, update_vaos);
+    glGenVertexArrays(2, draw_vaos);
+    for (int i=0; i<2; i++) {
+        glBindBuffer(GL_ARRAY_BUFFER, buffers[i]);
+        glBufferData(GL_ARRAY_BUFFER, sizeof(Particle)*PARTICLE_CAPACITY, &zero[0], GL_DYNAMIC_COPY);
+        setupAttributes(update_vaos[i], buffers[i], 0);
+        setupAttributes(draw_vaos[i], buffers[i], 1);
+    }
+    glBindVertexArray(0);
+}
+
+void particlesSetColor (int index, float r, float g, float b, VAO* quad)
+{
+    palette[index][0] = r;
+    palette[index][1] = g;
+    palette[index][2] = b;
+    palette_quads[index] = quad;
+}
+
+void particlesEmit (float x, float y, int count, float speed, float life, int color)
+{
+    for (int i=0; i<count; i++) {
+        float angle = randomUnit()*2*M_PI;
+        float v = speed*(0.3f + 0.7f*randomUnit());
+        Particle p = { x, y, v*cos(angle), v*sin(angle), life*(0.5f + 0.5f*randomUnit()), (float)color };
+        pending.push_back(p);
+    }
+    active = max(active, life);
+}
+
+/* Copy pending particles into ring slots [first, first+count) */
+static void storePending (int first, const Particle* p, int count)
+{
+    if (gpu) {
+        glBindBuffer(GL_ARRAY_BUFFER, buffers[current]);
+        glBufferSubData(GL_ARRAY_BUFFER, first*sizeof(Particle), count*sizeof(Particle), p);
+        return;
+    }
+    for (int i=0; i<count; i++) {
+        cpu_x[first+i] = p[i].x;
+        cpu_y[first+i] = p[i].y;
+        cpu_vx[first+i] = p[i].vx;
+        cpu_vy[first+i] = p[i].vy;
+        cpu_life[first+i] = p[i].life;
+        cpu_color[first+i] = p[i].color;
+    }
+}
+
+static void flushPending ()
+{
+    // A burst bigger than the ring only keeps its newest particles
+    int count = min((int)pending.size(), PARTICLE_CAPACITY);
+    const Particle* p = &pending[0] + (pending.size() - count);
+    while (count > 0) {
+        int run = min(count, PARTICLE_CAPACITY - next_slot);
+        storePending(next_slot, p, run);
+        next_slot = (next_slot + run) % PARTICLE_CAPACITY;
+        used = max(used, next_slot == 0 ? PARTICLE_CAPACITY : next_slot);
+        p += run;
+        count -= run;
+    }
+    pending.clear();
+}
+
+#if defined(__AVX2__)
+
+static void stepCPU (int count, float dt)
+{
+    const __m256 t = _mm256_set1_ps(dt), fall = _mm256_set1_ps(GRAVITY*dt);
+    for (int i=0; i<count; i+=8) {
+        __m256 vy = _mm256_sub_ps(_mm256_load_ps(cpu_vy + i), fall);
+        _mm256_store_ps(cpu_vy + i, vy);
+        _mm256_store_ps(cpu_x + i, _mm256_add_ps(_mm256_load_ps(cpu_x + i), _mm256_mul_ps(_mm256_load_ps(cpu_vx + i), t)));
+        _mm256_store_ps(cpu_y + i, _mm256_add_ps(_mm256_load_ps(cpu_y + i), _mm256_mul_ps(vy, t)));
+        _mm256_store_ps(cpu_life + i, _mm256_sub_ps(_mm256_load_ps(cpu_life + i), t));
+    }
+}
+
+#elif defined(__SSE2__)
+
+static void stepCPU (int count, float dt)
+{
+    const __m128 t = _mm_set1_ps(dt), fall = _mm_set1_ps(GRAVITY*dt);
+    for (int i=0; i<count; i+=4) {
+        __m128 vy = _mm_sub_ps(_mm_load_ps(cpu_vy + i), fall);
+        _mm_store_ps(cpu_vy + i, vy);
+        _mm_store_ps(cpu_x + i, _mm_add_ps(_mm_load_ps(cpu_x + i), _mm_mul_ps(_mm_load_ps(cpu_vx + i), t)));
+        _mm_store_ps(cpu_y + i, _mm_add_ps(_mm_load_ps(cpu_y + i), _mm_mul_ps(vy, t)));
+        _mm_store_ps(cpu_life + i, _mm_sub_ps(_mm_load_ps(cpu_life + i), t));
+    }
+}
+
+#else
+
+static void stepCPU (int count, float dt)
+{
+    for (int i=0; i<count; i++) {
+        cpu_vy[i] -= GRAVITY*dt;
+        cpu_x[i] += cpu_vx[i]*dt;
+        cpu_y[i] += cpu_vy[i]*dt;
+        cpu_life[i] -= dt;
+    }
+}
+
+#endif
+
+static void stepGPU (float dt)
+{
+    glUseProgram(update_program);
+    glUniform1f(update_dt, dt);
+    glUniform1f(update_gravity, GRAVITY);
+
+    glEnable(GL_RASTERIZER_DISCARD);
+    glBindVertexArray(update_vaos[current]);
+    glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, buffers[1 - current]);
+    glBeginTransformFeedback(GL_POINTS);
+    glDrawArrays(GL_POINTS, 0, used);
+    glEndTransformFeedback();
+    glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, 0);
+    glDisable(GL_RASTERIZER_DISCARD);
+    current = 1 - current;
+}
+
+void particlesUpdate (float dt)
+{
+    if (!pending.empty())
+        flushPending();
+    if (active <= 0 || dt <= 0)
+        return;
+    active -= dt;
+
+    if (gpu)
+        stepGPU(dt);
+    else
+        stepCPU((used + 7) & ~7, dt);   // whole vectors, the capacity is a multiple of 8
+}
+
+void particlesDraw (Renderer* renderer, const glm::mat4& VP, float size)
+{
+    if (active <= 0)
+        return;
+
+    if (gpu) {
+        glUseProgram(draw_program);
+        glUniformMatrix4fv(draw_vp, 1, GL_FALSE, &VP[0][0]);
+        glUniform1f(draw_size, size);
+        glUniform3fv(draw_palette, PARTICLE_COLORS, &palette[0][0]);
+        glBindVertexArray(draw_vaos[current]);
+        glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+        glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, used);
+        return;
+    }
+
+    for (int i=0; i<used; i++) {
+        if (cpu_life[i] <= 0)
+            continue;
+        // Shrink away over the last quarter second, like Particles.vert
+        float s = size*min(cpu_life[i]*4, 1.0f);
+        glm::mat4 model = glm::translate(glm::vec3(cpu_x[i], cpu_y[i], 0.0f)) * glm::scale(glm::vec3(s, s, 1.0f));
+        renderer->drawObject(palette_quads[(int)cpu_color[i]], VP * model);
+    }
+}
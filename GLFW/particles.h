@@ -0,0 +1,37 @@
+#ifndef PARTICLES_H
+#define PARTICLES_H
+
+#include "renderer.h"
+
+static const int PARTICLE_CAPACITY = 1 << 17;   // particles alive at once, oldest are overwritten
+static const int PARTICLE_COLORS = 8;
+
+/* One particle, as laid out in the GPU buffers */
+struct Particle {
+    GLfloat x, y, vx, vy;
+    GLfloat life;       // seconds left, dead at <= 0
+    GLfloat color;      // palette index
+};
+
+/* Sparks and debris. With both programs (Particles_update.vert, captured by
+   transform feedback, and Particles.vert) the particles live in two GPU
+   buffers that are stepped into each other and drawn as one instanced call.
+   Without them (software renderer) a SIMD loop steps them on the CPU and each
+   one is drawn as the palette's quad. Call with the GL context current. */
+void particlesInit (GLuint update_program, GLuint draw_program);
+
+/* Palette entry. 'quad' is a unit quad of that color, used by the CPU path */
+void particlesSetColor (int index, float r, float g, float b, VAO* quad);
+
+/* A burst of 'count' particles from (x,y) in random directions, up to 'speed'
+   units/s and 'life' seconds. Only queued: cheap enough for the game tick,
+   and deterministic (fixed seed) so replays look the same. */
+void particlesEmit (float x, float y, int count, float speed, float life, int color);
+
+/* Add the queued bursts and advance everything by dt seconds */
+void particlesUpdate (float dt);
+
+/* size is the particle's edge in world units */
+void particlesDraw (Renderer* renderer, const glm::mat4& VP, float size);
+
+#endif
@@ -0,0 +1,127 @@
+#include <chrono>
+#include <cstring>
+
+#include "profiler.h"
+
+using namespace std;
+
+static vector<ProfileStat> stats;
+static int gpu_enabled = 0;
+static int gpu_active = -1;     // only one GL_TIME_ELAPSED query may run at a time
+static long frame = 0;
+
+int profilerRegister (const char* label, int gpu)
+{
+    ProfileStat stat;
+    memset(&stat, 0, sizeof(stat));
+    stat.label = label;
+    stat.gpu = gpu;
+    stats.push_back(stat);
+    return stats.size() - 1;
+}
+
+void profilerEnableGPU (int enable)
+{
+    gpu_enabled = enable;
+}
+
+double profilerNow ()
+{
+    return chrono::duration<double>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void profilerEndCPU (int id, double start)
+{
+    stats[id].cpu_accum += (profilerNow() - start)*1000.0;
+}
+
+/* Read back a query issued two frames ago, if the GPU has finished it */
+static int collectQuery (ProfileStat& stat, int slot)
+{
+    if (!stat.query_pending[slot])
+        return 1;
+
+    GLint available = 0;
+    glGetQueryObjectiv(stat.queries[slot], GL_QUERY_RESULT_AVAILABLE, &available);
+    if (!available)
+        return 0;
+
+    GLuint64 elapsed = 0;
+    glGetQueryObjectui64v(stat.queries[slot], GL_QUERY_RESULT, &elapsed);
+    stat.gpu_ms[stat.gpu_next] = elapsed/1.0e6;
+    stat.gpu_next = (stat.gpu_next + 1) % PROFILE_HISTORY;
+    if (stat.gpu_count < PROFILE_HISTORY)
+        stat.gpu_count++;
+    stat.query_pending[slot] = 0;
+    return 1;
+}
+
+void profilerBeginGPU (int id)
+{
+    ProfileStat& stat = stats[id];
+    if (!gpu_enabled || !stat.gpu || gpu_active >= 0)
+        return;
+
+    if (!stat.queries[0])
+        glGenQueries(2, stat.queries);
+
+    // Still waiting on the result from two frames ago: skip rather than stall
+    int slot = frame & 1;
+    if (!collectQuery(stat, slot))
+        return;
+
+    glBeginQuery(GL_TIME_ELAPSED, stat.queries[slot]);
+    stat.query_pending[slot] = 1;
+    gpu_active = id;
+}
+
+void profilerEndGPU (int id)
+{
+    if (gpu_active != id)
+        return;
+    glEndQuery(GL_TIME_ELAPSED);
+    gpu_active = -1;
+}
+
+void profilerEndFrame ()
+{
+    for (size_t i=0; i<stats.size(); i++) {
+        ProfileStat& stat = stats[i];
+        stat.cpu_ms[stat.cpu_next] = stat.cpu_accum;
+        stat.cpu_next = (stat.cpu_next + 1) % PROFILE_HISTORY;
+        if (stat.cpu_count < PROFILE_HISTORY)
+            stat.cpu_count++;
+        stat.cpu_accum = 0;
+
+        // Pick up whatever the previous frame's queries produced
+        if (gpu_enabled && stat.query_pending[(frame + 1) & 1])
+            collectQuery(stat, (frame + 1) & 1);
+    }
+    frame++;
+}
+
+double profilerAverage (int id, int gpu)
+{
+    const double* ms = gpu ? stats[id].gpu_ms : stats[id].cpu_ms;
+    int count = gpu ? stats[id].gpu_count : stats[id].cpu_count;
+    if (!count)
+        return 0;
+    // Until the ring is full the unwritten slots are still zero
+    double total = 0;
+    for (int i=0; i<PROFILE_HISTORY; i++)
+        total += ms[i];
+    return total/count;
+}
+
+double profilerSample (int id, int gpu, int n)
+{
+    const ProfileStat& stat = stats[id];
+    int next = gpu ? stat.gpu_next : stat.cpu_next;
+    int index = ((next - 1 - n) % PROFILE_HISTORY + PROFILE_HISTORY) % PROFILE_HISTORY;
+    return gpu ? stat.gpu_ms[index] : stat.cpu_ms[index];
+}
+
+const vector<ProfileStat>& profilerStats ()
+{
+    return stats;
+}
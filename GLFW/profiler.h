@@ -0,0 +1,59 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <vector>
+
+#include <glad/glad.h>
+
+static const int PROFILE_HISTORY = 120;  // frames of rolling history per scope
+
+/* Timings for one named section of the frame. CPU time is measured with a
+   steady clock, GPU time with a pair of GL_TIME_ELAPSED queries that are
+   alternated between even and odd frames and read back two frames later, so
+   fetching a result never waits on the GPU. */
+struct ProfileStat {
+    const char* label;
+    int gpu;                                // also time the section on the GPU
+
+    double cpu_ms[PROFILE_HISTORY];
+    double gpu_ms[PROFILE_HISTORY];
+    int cpu_next, gpu_next;                 // ring buffer write positions
+    int cpu_count, gpu_count;               // samples recorded, up to PROFILE_HISTORY
+    double cpu_accum;                       // CPU time so far in this frame
+
+    GLuint queries[2];
+    int query_pending[2];
+};
+
+/* Register a scope, returns the id to pass to ProfileScope */
+int profilerRegister (const char* label, int gpu);
+
+/* GPU queries are only issued while enabled (needs a current GL context) */
+void profilerEnableGPU (int enable);
+
+/* Close the current frame: store CPU totals and collect finished GPU queries */
+void profilerEndFrame ();
+
+double profilerNow ();              // seconds
+void profilerEndCPU (int id, double start);
+void profilerBeginGPU (int id);
+void profilerEndGPU (int id);
+
+/* Rolling average over the samples in the history (ms), 0 before the first,
+   and the n-th most recent sample */
+double profilerAverage (int id, int gpu);
+double profilerSample (int id, int gpu, int n);
+const std::vector<ProfileStat>& profilerStats ();
+
+/* RAII scope: times everything until the end of the enclosing block */
+class ProfileScope {
+public:
+    ProfileScope (int id) : id(id), start(profilerNow()) { profilerBeginGPU(id); }
+    ~ProfileScope () { profilerEndGPU(id); profilerEndCPU(id, start); }
+
+private:
+    int id;
+    double start;
+};
+
+#endif
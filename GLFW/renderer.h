@@ -0,0 +1,60 @@
+#ifndef RENDERER_H
+#define RENDERER_H
+
+#include <vector>
+
+#include <glad/glad.h>
+
+#define GLM_FORCE_RADIANS
+#include <glm/glm.hpp>
+
+/* 8 byte vertex: 2D position in int16 fixed point and an RGBA8 color.
+   Sprites are flat (z = 0) and the scene fits well inside +-4096 units. */
+static const float VERTEX_POSITION_SCALE = 8.0f;   // int16 steps per world unit
+
+struct PackedVertex {
+    GLshort x, y;
+    GLubyte color[4];   // normalized when read by the shader
+};
+
+struct VAO {
+    GLuint VertexArrayID;
+    GLuint VertexBuffer;    // interleaved PackedVertex
+    GLuint IndexBuffer;     // 0 when the mesh uses the shared quad indices
+
+    GLenum PrimitiveMode;
+    GLenum FillMode;
+    int NumVertices;        // distinct vertices
+    int NumIndices;
+    int RefCount;           // sprites sharing this mesh, see meshes.h
+
+    // CPU copies, also what the software renderer draws from
+    std::vector<PackedVertex> Vertices;
+    std::vector<GLushort> Indices;
+};
+typedef struct VAO VAO;
+
+/* Drawing backend used by draw(). The GL backend renders through the shader
+   pair loaded by LoadShaders, the software backend rasterizes on the CPU into
+   a memory framebuffer and needs no GL context at all. */
+class Renderer {
+public:
+    virtual ~Renderer () {}
+
+    virtual bool usesGL () const = 0;
+    virtual void setClearColor (float r, float g, float b, float a) = 0;
+    virtual void resize (int width, int height) = 0;
+
+    /* 'covered': the frame will be drawn over in full, so only depth needs clearing */
+    virtual void beginFrame (bool covered) = 0;
+    virtual void drawObject (VAO* vao, const glm::mat4& MVP) = 0;
+    virtual void endFrame () = 0;
+
+    /* RGBA8, bottom row first (same layout as glReadPixels) */
+    virtual void readPixels (int width, int height, unsigned char* rgba) = 0;
+};
+
+/* threads <= 0 picks one worker per hardware thread */
+Renderer* createSoftwareRenderer (int width, int height, int threads);
+
+#endif
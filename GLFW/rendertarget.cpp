@@ -0,0 +1,98 @@
+#include <cstdio>
+
+#include "rendertarget.h"
+
+static GLuint blit_program = 0;
+static GLint blit_sampler = -1;
+static GLuint blit_vao = 0;
+static const RenderTarget* frame_target = NULL;
+
+bool renderTargetResize (RenderTarget* target, int width, int height)
+{
+    if (target->fbo && target->width == width && target->height == height)
+        return false;
+    renderTargetDestroy(target);
+
+    target->width = width;
+    target->height = height;
+
+    glGenTextures(1, &target->color);
+    glBindTexture(GL_TEXTURE_2D, target->color);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    glGenRenderbuffers(1, &target->depth);
+    glBindRenderbuffer(GL_RENDERBUFFER, target->depth);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+    glGenFramebuffers(1, &target->fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, target->fbo);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, target->color, 0);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, target->depth);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+        fprintf(stderr, "Render target %dx%d is incomplete\n", width, height);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    return true;
+}
+
+void renderTargetBind (const RenderTarget* target, int window_width, int window_height)
+{
+    if (!target)
+        target = frame_target;
+    if (target) {
+        glBindFramebuffer(GL_FRAMEBUFFER, target->fbo);
+        glViewport(0, 0, target->width, target->height);
+    }
+    else {
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        glViewport(0, 0, window_width, window_height);
+    }
+}
+
+void renderTargetSetFrame (const RenderTarget* target)
+{
+    frame_target = target;
+}
+
+void renderTargetDestroy (RenderTarget* target)
+{
+    if (target->fbo)
+        glDeleteFramebuffers(1, &target->fbo);
+    if (target->color)
+        glDeleteTextures(1, &target->color);
+    if (target->depth)
+        glDeleteRenderbuffers(1, &target->depth);
+    target->fbo = target->color = target->depth = 0;
+    target->width = target->height = 0;
+}
+
+void blitInit (GLuint program)
+{
+    blit_program = program;
+    blit_sampler = glGetUniformLocation(program, "source");
+    // The vertex shader makes its own corners, but core profile still wants a VAO bound
+    if (!blit_vao)
+        glGenVertexArrays(1, &blit_vao);
+}
+
+void blitTexture (GLuint texture)
+{
+    GLboolean depth_test = glIsEnabled(GL_DEPTH_TEST);
+    glDisable(GL_DEPTH_TEST);
+
+    glUseProgram(blit_program);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glUniform1i(blit_sampler, 0);
+    glBindVertexArray(blit_vao);
+    glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+
+    if (depth_test)
+        glEnable(GL_DEPTH_TEST);
+}
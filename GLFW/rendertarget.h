@@ -0,0 +1,32 @@
+#ifndef RENDERTARGET_H
+#define RENDERTARGET_H
+
+#include <glad/glad.h>
+
+/* Offscreen framebuffer with an RGBA8 color texture and a depth buffer */
+struct RenderTarget {
+    GLuint fbo;
+    GLuint color;       // texture, sampled by blitTexture
+    GLuint depth;       // renderbuffer
+    int width, height;
+};
+
+/* (Re)allocate for the given size. Returns true when storage was recreated,
+   i.e. the previous contents are gone */
+bool renderTargetResize (RenderTarget* target, int width, int height);
+
+/* Render into 'target' (or the frame when NULL), setting the viewport to match */
+void renderTargetBind (const RenderTarget* target, int window_width, int window_height);
+
+/* Where the frame is drawn, i.e. what renderTargetBind(NULL, ...) binds: the
+   window (NULL, the default) or a target the frame is rendered into at a
+   different size and then scaled to the window */
+void renderTargetSetFrame (const RenderTarget* target);
+
+void renderTargetDestroy (RenderTarget* target);
+
+/* Full-screen textured quad with the program built from Blit.vert/Blit.frag */
+void blitInit (GLuint program);
+void blitTexture (GLuint texture);
+
+#endif
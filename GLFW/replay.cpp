@@ -0,0 +1,38 @@
+#include <cstdio>
+
+#include "replay.h"
+
+using namespace std;
+
+bool replayLoad (const char* path, vector<ReplayEvent>& events)
+{
+    FILE* fp = fopen(path, "r");
+    if (!fp) {
+        fprintf(stderr, "Replay: cannot open %s\n", path);
+        return false;
+    }
+
+    ReplayEvent ev;
+    while (fscanf(fp, "%ld %c %d %d %d %lf %lf", &ev.tick, &ev.type, &ev.code, &ev.action, &ev.mods, &ev.x, &ev.y) == 7)
+        events.push_back(ev);
+
+    fclose(fp);
+    return true;
+}
+
+bool replaySave (const char* path, const vector<ReplayEvent>& events)
+{
+    FILE* fp = fopen(path, "w");
+    if (!fp) {
+        fprintf(stderr, "Replay: cannot write %s\n", path);
+        return false;
+    }
+
+    for (size_t i=0; i<events.size(); i++) {
+        const ReplayEvent& ev = events[i];
+        fprintf(fp, "%ld %c %d %d %d %.3f %.3f\n", ev.tick, ev.type, ev.code, ev.action, ev.mods, ev.x, ev.y);
+    }
+
+    fclose(fp);
+    return true;
+}
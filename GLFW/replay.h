@@ -0,0 +1,22 @@
+#ifndef REPLAY_H
+#define REPLAY_H
+
+#include <vector>
+
+/* One recorded input event, stamped with the simulation tick that consumed it */
+struct ReplayEvent {
+    long tick;
+    char type;      // 'K' key, 'C' char, 'B' mouse button, 'M' cursor move, 'S' scroll
+    int code;       // key, codepoint or mouse button
+    int action;
+    int mods;
+    double x,y;     // cursor position (or scroll offsets for 'S')
+};
+
+/* Load a replay written by replaySave. Returns false if the file can't be read */
+bool replayLoad (const char* path, std::vector<ReplayEvent>& events);
+
+/* Write events as one line per event: tick type code action mods x y */
+bool replaySave (const char* path, const std::vector<ReplayEvent>& events);
+
+#endif
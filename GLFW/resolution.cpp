@@ -0,0 +1,84 @@
+#include <algorithm>
+#include <cmath>
+
+#include "resolution.h"
+
+using namespace std;
+
+static const double SMOOTHING = 0.15;       // EWMA weight of the newest frame
+static const double OVER_BUDGET = 1.10;     // average above budget*this: scale down
+static const double WITHIN_BUDGET = 1.05;   // a frame below budget*this counts towards scaling up
+static const int SETTLE_FRAMES = 8;         // frames after a change before judging it
+static const int MIN_UP_WAIT = 60;
+static const int MAX_UP_WAIT = 480;
+static const float UP_STEP = 0.05f;
+
+static double budget = 1000.0/60.0;
+static float min_scale = 1;
+static float scale = 1;
+
+static double average = 0;
+static int since_change = 0;
+static int good_frames = 0;         // consecutive frames within budget
+static int up_wait = MIN_UP_WAIT;   // good frames needed before a step up
+static int since_up = -1;           // frames since the last step up, -1 if it has held
+
+void resolutionInit (double budget_ms, float minimum)
+{
+    budget = budget_ms;
+    min_scale = min(minimum, 1.0f);
+    scale = 1;
+    average = budget;
+    since_change = good_frames = 0;
+    up_wait = MIN_UP_WAIT;
+    since_up = -1;
+}
+
+static void setScale (float value)
+{
+    scale = min(1.0f, max(min_scale, value));
+    average = budget;
+    since_change = 0;
+    good_frames = 0;
+}
+
+float resolutionUpdate (double frame_ms)
+{
+    if (min_scale >= 1)
+        return 1;
+
+    average += (frame_ms - average)*SMOOTHING;
+    since_change++;
+    good_frames = frame_ms <= budget*WITHIN_BUDGET ? good_frames + 1 : 0;
+    if (since_up >= 0 && ++since_up >= up_wait) {
+        // The last step up held: be quicker to try the next one
+        up_wait = max(MIN_UP_WAIT, up_wait/2);
+        since_up = -1;
+    }
+
+    if (since_change < SETTLE_FRAMES)
+        return scale;
+
+    if (average > budget*OVER_BUDGET && scale > min_scale) {
+        if (since_up >= 0) {
+            // The last step up was too far: undo it and wait longer before the next
+            up_wait = min(MAX_UP_WAIT, up_wait*2);
+            since_up = -1;
+            setScale(scale - UP_STEP);
+            return scale;
+        }
+        // Cost goes with the pixel count, so scale each axis by the square root
+        float factor = sqrt(budget/average);
+        setScale(scale*min(0.95f, max(0.75f, factor)));
+    }
+    else if (good_frames >= up_wait && scale < 1) {
+        setScale(scale + UP_STEP);
+        since_up = 0;
+    }
+    return scale;
+}
+
+float resolutionScale ()
+{
+    return scale;
+}
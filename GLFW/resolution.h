@@ -0,0 +1,17 @@
+#ifndef RESOLUTION_H
+#define RESOLUTION_H
+
+/* Dynamic resolution. Fed the time between presented frames, it lowers the
+   render scale when frames run over budget and raises it again after a run
+   of frames within budget. Each step up that is soon undone by a step down
+   doubles the wait before the next one, so the scale settles instead of
+   bouncing. min_scale >= 1 keeps the scale fixed at 1. */
+void resolutionInit (double budget_ms, float min_scale);
+
+/* Time between the last two presented frames. Returns the scale (min_scale..1,
+   of each axis) to render the next frame at */
+float resolutionUpdate (double frame_ms);
+
+float resolutionScale ();
+
+#endif
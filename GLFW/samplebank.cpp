@@ -0,0 +1,228 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <thread>
+
+#include <mpg123.h>
+
+#include "samplebank.h"
+
+using namespace std;
+
+static const size_t ALIGN_FLOATS = 16;      // each sample starts on a 64 byte boundary
+
+static float* arena = NULL;
+static size_t arena_floats = 0;
+static vector<Sample> samples;
+
+static unsigned short read16 (const unsigned char* p)
+{
+    return p[0] | p[1] << 8;
+}
+
+static unsigned int read32 (const unsigned char* p)
+{
+    return p[0] | p[1] << 8 | p[2] << 16 | (unsigned int)p[3] << 24;
+}
+
+/* Mono float frames from a RIFF WAVE file: 8, 16, 24 or 32 bit integer PCM
+   or 32 bit float, any channel count (averaged) */
+static bool decodeWav (const string& path, vector<float>& out, int* rate)
+{
+    FILE* file = fopen(path.c_str(), "rb");
+    if (!file)
+        return false;
+    vector<unsigned char> bytes;
+    unsigned char buffer[65536];
+    size_t n;
+    while ((n = fread(buffer, 1, sizeof(buffer), file)) > 0)
+        bytes.insert(bytes.end(), buffer, buffer + n);
+    fclose(file);
+
+    if (bytes.size() < 12 || memcmp(&bytes[0], "RIFF", 4) || memcmp(&bytes[8], "WAVE", 4))
+        return false;
+    int format = 0, channels = 0, bits = 0;
+    const unsigned char* data = NULL;
+    size_t data_size = 0;
+    for (size_t at = 12; at + 8 <= bytes.size(); ) {
+        const unsigned char* chunk = &bytes[at];
+        size_t size = min((size_t)read32(chunk + 4), bytes.size() - at - 8);
+        if (!memcmp(chunk, "fmt ", 4) && size >= 16) {
+            format = read16(chunk + 8);
+            channels = read16(chunk + 10);
+            *rate = read32(chunk + 12);
+            bits = read16(chunk + 22);
+            if (format == 0xFFFE && size >= 26)     // WAVE_FORMAT_EXTENSIBLE, the subformat says which
+                format = read16(chunk + 32);
+        }
+        else if (!memcmp(chunk, "data", 4)) {
+            data = chunk + 8;
+            data_size = size;
+        }
+        at += 8 + size + (size & 1);
+    }
+    bool is_float = format == 3 && bits == 32;
+    if (!data || channels <= 0 || *rate <= 0 || !(is_float || (format == 1 && bits >= 8 && bits <= 32 && bits % 8 == 0)))
+        return false;
+
+    int bytes_per_sample = bits/8;
+    size_t frames = data_size/(bytes_per_sample*channels);
+    out.resize(frames);
+    for (size_t i=0; i<frames; i++) {
+        float sum = 0;
+        for (int c=0; c<channels; c++) {
+            const unsigned char* p = data + (i*channels + c)*bytes_per_sample;
+            float v;
+            if (is_float) {
+                unsigned int word = read32(p);
+                memcpy(&v, &word, sizeof(v));
+            }
+            else if (bits == 8)
+                v = (p[0] - 128)/128.0f;
+            else {
+                // Left align in 32 bits so the sign bit lands in place
+                unsigned int word = 0;
+                for (int b=0; b<bytes_per_sample; b++)
+                    word |= (unsigned int)p[b] << (32 - bits + 8*b);
+                v = (int)word/2147483648.0f;
+            }
+            sum += v;
+        }
+        out[i] = sum/channels;
+    }
+    return true;
+}
+
+/* Mono float frames from an MP3, decoded to 16 bit at the file's own rate */
+static bool decodeMp3 (const string& path, vector<float>& out, int* rate)
+{
+    int error;
+    mpg123_handle* mh = mpg123_new(NULL, &error);
+    if (!mh)
+        return false;
+    mpg123_param(mh, MPG123_ADD_FLAGS, MPG123_QUIET, 0);
+    const long* rates;
+    size_t rate_count;
+    mpg123_rates(&rates, &rate_count);
+    mpg123_format_none(mh);
+    for (size_t i=0; i<rate_count; i++)
+        mpg123_format(mh, rates[i], MPG123_MONO | MPG123_STEREO, MPG123_ENC_SIGNED_16);
+
+    long file_rate;
+    int channels, encoding;
+    bool ok = mpg123_open(mh, path.c_str()) == MPG123_OK &&
+              mpg123_getformat(mh, &file_rate, &channels, &encoding) == MPG123_OK;
+    if (ok) {
+        *rate = file_rate;
+        short pcm[4096];
+        size_t done;
+        int status;
+        do {
+            status = mpg123_read(mh, pcm, sizeof(pcm), &done);
+            size_t count = done/sizeof(short);
+            for (size_t i=0; i+channels<=count; i+=channels) {
+                float sum = 0;
+                for (int c=0; c<channels; c++)
+                    sum += pcm[i+c];
+                out.push_back(sum/(32768.0f*channels));
+            }
+        } while (status == MPG123_OK);
+        ok = status == MPG123_DONE && !out.empty();
+        mpg123_close(mh);
+    }
+    mpg123_delete(mh);
+    return ok;
+}
+
+/* Linear interpolation, plenty for short effects */
+static void resample (vector<float>& samples, int from, int to)
+{
+    if (from == to || samples.empty())
+        return;
+    size_t frames = max((size_t)1, (size_t)((double)samples.size()*to/from));
+    vector<float> out(frames);
+    double step = (double)from/to;
+    for (size_t i=0; i<frames; i++) {
+        double at = i*step;
+        size_t j = min((size_t)at, samples.size() - 1);
+        float f = at - j;
+        float next = j + 1 < samples.size() ? samples[j+1] : samples[j];
+        out[i] = samples[j] + (next - samples[j])*f;
+    }
+    samples.swap(out);
+}
+
+static void decode (const SampleSource& source, int rate, vector<float>& out)
+{
+    int file_rate = rate;
+    string path = source.path;
+    bool ok = decodeWav(path + ".wav", out, &file_rate);
+    if (!ok) {
+        out.clear();
+        ok = decodeMp3(path + ".mp3", out, &file_rate);
+    }
+    if (ok)
+        resample(out, file_rate, rate);
+    else {
+        out.clear();
+        source.synth(out, rate);
+    }
+}
+
+void sampleBankLoad (const SampleSource* sources, int count, int rate)
+{
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    mpg123_init();
+
+    // Workers take the next source until none are left, each into its own vector
+    vector< vector<float> > decoded(count);
+    atomic<int> next(0);
+    int worker_count = max(1, min(count, (int)thread::hardware_concurrency()));
+    vector<thread> workers;
+    for (int w=0; w<worker_count; w++)
+        workers.push_back(thread([&]() {
+            for (int i; (i = next++) < count; )
+                decode(sources[i], rate, decoded[i]);
+        }));
+    for (size_t w=0; w<workers.size(); w++)
+        workers[w].join();
+    mpg123_exit();
+
+    // Pack them, each rounded up to the alignment so every start stays aligned
+    sampleBankFree();
+    for (int i=0; i<count; i++)
+        arena_floats += (decoded[i].size() + ALIGN_FLOATS - 1)/ALIGN_FLOATS*ALIGN_FLOATS;
+    if (posix_memalign((void**)&arena, ALIGN_FLOATS*sizeof(float), max((size_t)1, arena_floats)*sizeof(float)))
+        abort();
+    float* at = arena;
+    for (int i=0; i<count; i++) {
+        size_t padded = (decoded[i].size() + ALIGN_FLOATS - 1)/ALIGN_FLOATS*ALIGN_FLOATS;
+        copy(decoded[i].begin(), decoded[i].end(), at);
+        fill(at + decoded[i].size(), at + padded, 0.0f);
+        Sample sample = { at, decoded[i].size() };
+        samples.push_back(sample);
+        at += padded;
+    }
+
+    double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+    cout << "SOUNDS: " << count << " samples, " << arena_floats*sizeof(float)/1024 << " KB arena, decoded in "
+         << ms << " ms on " << worker_count << " threads" << endl;
+}
+
+void sampleBankFree ()
+{
+    free(arena);
+    arena = NULL;
+    arena_floats = 0;
+    samples.clear();
+}
+
+Sample sampleBankGet (int handle)
+{
+    return samples[handle];
+}
@@ -0,0 +1,30 @@
+#ifndef SAMPLEBANK_H
+#define SAMPLEBANK_H
+
+#include <cstddef>
+#include <vector>
+
+/* Where a sample comes from. path has no extension: path.wav and then
+   path.mp3 (through mpg123) are tried, and synth makes the sample at the
+   given rate when neither file can be decoded. */
+struct SampleSource {
+    const char* path;
+    void (*synth) (std::vector<float>& out, int rate);
+};
+
+/* A decoded sample: mono floats at the bank's rate, inside the arena */
+struct Sample {
+    const float* data;
+    size_t frames;
+};
+
+/* Decode every source on worker threads, resample them to 'rate' and pack
+   them into one arena. The handle of sources[i] is i. Prints the arena size
+   and decode time. Call once, before any sampleBankGet. */
+void sampleBankLoad (const SampleSource* sources, int count, int rate);
+void sampleBankFree ();
+
+/* No copy and no decoding, safe from any thread once loaded */
+Sample sampleBankGet (int handle);
+
+#endif
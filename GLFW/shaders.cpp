@@ -0,0 +1,427 @@
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <deque>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include "shaders.h"
+
+using namespace std;
+
+static const char* cache_dir = ".";
+
+static const unsigned int CACHE_MAGIC = 0x4353544c;    // "LTSC"
+
+/* On-disk layout: header followed by the driver's binary blob */
+struct CacheHeader {
+    unsigned int magic;
+    unsigned int format;        // binaryFormat from glGetProgramBinary
+    unsigned int length;
+    unsigned long long key;     // repeated so a renamed file can't be misused
+};
+
+void shaderCacheSetDir (const char* dir)
+{
+    cache_dir = dir;
+}
+
+/* Read a whole file in one go. Returns false if it can't be opened */
+static bool readFile (const char* path, string& out)
+{
+    FILE* fp = fopen(path, "rb");
+    if (!fp) {
+        fprintf(stderr, "Cannot open shader %s\n", path);
+        return false;
+    }
+    fseek(fp, 0, SEEK_END);
+    long size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    out.resize(size > 0 ? size : 0);
+    if (size > 0 && fread(&out[0], 1, size, fp) != (size_t)size)
+        out.clear();
+    fclose(fp);
+    return true;
+}
+
+/* 64-bit FNV-1a, chained through 'hash' so several strings give one key */
+static unsigned long long fnv1a (const char* data, size_t len, unsigned long long hash)
+{
+    for (size_t i=0; i<len; i++) {
+        hash ^= (unsigned char)data[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+static unsigned long long cacheKey (const string& vertex, const string& fragment, const string& feedback)
+{
+    const char* parts[] = {
+        vertex.c_str(), fragment.c_str(), feedback.c_str(),
+        (const char*)glGetString(GL_VENDOR),
+        (const char*)glGetString(GL_RENDERER),
+        (const char*)glGetString(GL_VERSION)
+    };
+    unsigned long long hash = 14695981039346656037ULL;
+    for (size_t i=0; i<sizeof(parts)/sizeof(parts[0]); i++) {
+        const char* p = parts[i] ? parts[i] : "";
+        hash = fnv1a(p, strlen(p) + 1, hash);   // include the NUL as a separator
+    }
+    return hash;
+}
+
+static string cachePath (unsigned long long key)
+{
+    char name[64];
+    snprintf(name, sizeof(name), "/shader_%016llx.bin", key);
+    return string(cache_dir) + name;
+}
+
+static bool binariesSupported ()
+{
+    if (!cache_dir || !(GLAD_GL_VERSION_4_1 || GLAD_GL_ARB_get_program_binary))
+        return false;
+    GLint formats = 0;
+    glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+    return formats > 0;
+}
+
+/* Returns a linked program from the cache, or 0 on a miss or if the driver rejects it */
+static GLuint loadCachedProgram (unsigned long long key)
+{
+    string path = cachePath(key);
+    FILE* fp = fopen(path.c_str(), "rb");
+    if (!fp)
+        return 0;
+
+    CacheHeader header;
+    vector<char> blob;
+    if (fread(&header, sizeof(header), 1, fp) == 1 && header.magic == CACHE_MAGIC && header.key == key) {
+        blob.resize(header.length);
+        if (header.length == 0 || fread(&blob[0], 1, header.length, fp) != header.length)
+            blob.clear();
+    }
+    fclose(fp);
+    if (blob.empty())
+        return 0;
+
+    GLuint program = glCreateProgram();
+    glProgramBinary(program, header.format, &blob[0], blob.size());
+    GLint linked = GL_FALSE;
+    glGetProgramiv(program, GL_LINK_STATUS, &linked);
+    if (!linked) {
+        // Usually a driver update that slipped past the version string
+        glDeleteProgram(program);
+        remove(path.c_str());
+        return 0;
+    }
+    return program;
+}
+
+static void storeCachedProgram (GLuint program, unsigned long long key)
+{
+    GLint length = 0;
+    glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+    if (length <= 0)
+        return;
+
+    vector<char> blob(length);
+    GLenum format = 0;
+    glGetProgramBinary(program, length, NULL, &format, &blob[0]);
+
+    CacheHeader header = { CACHE_MAGIC, format, (unsigned int)length, key };
+
+    // Write to a temporary name and rename, so a crash never leaves half a file
+    string path = cachePath(key);
+    string tmp = path + ".tmp";
+    FILE* fp = fopen(tmp.c_str(), "wb");
+    if (!fp)
+        return;
+    bool ok = fwrite(&header, sizeof(header), 1, fp) == 1 && fwrite(&blob[0], 1, length, fp) == (size_t)length;
+    ok = (fclose(fp) == 0) && ok;
+    if (!ok || rename(tmp.c_str(), path.c_str()) != 0)
+        remove(tmp.c_str());
+}
+
+/* How programs get built, picked once by shaderCompilerInit */
+enum CompileMode {
+    COMPILE_SYNC,       // compile and link in the calling thread
+    COMPILE_PARALLEL,   // driver compiles on its own threads (ARB_parallel_shader_compile)
+    COMPILE_WORKER      // our worker threads, each on its own shared context
+};
+
+static CompileMode compile_mode = COMPILE_SYNC;
+
+struct ShaderBuild {
+    string vertex_path, fragment_path;     // no fragment path: vertex only (transform feedback)
+    string vertex_code, fragment_code;
+    vector<string> feedback;                // varyings captured by transform feedback
+    bool use_cache;
+    unsigned long long key;
+
+    GLuint vertex, fragment, program;
+    bool link_issued;
+    string log;                 // info logs, printed by finishProgram
+    atomic<int> done;           // set once the build needs nothing more from its thread
+};
+
+/* Worker state for COMPILE_WORKER. A GL context serializes everything
+   issued on it, so each worker needs its own for builds to overlap */
+static vector<thread> workers;
+static mutex worker_lock;
+static condition_variable worker_wake, worker_done;
+static deque<ShaderBuild*> worker_jobs;
+static bool worker_stop = false;
+
+static void appendShaderLog (ShaderBuild* build, GLuint shader, const string& path)
+{
+    GLint length = 0;
+    glGetShaderiv(shader, GL_INFO_LOG_LENGTH, &length);
+    if (length <= 1)
+        return;
+    vector<char> log(length);
+    glGetShaderInfoLog(shader, length, NULL, &log[0]);
+    build->log += path + ":\n" + &log[0] + "\n";
+}
+
+static void appendProgramLog (ShaderBuild* build)
+{
+    GLint length = 0;
+    glGetProgramiv(build->program, GL_INFO_LOG_LENGTH, &length);
+    if (length <= 1)
+        return;
+    vector<char> log(length);
+    glGetProgramInfoLog(build->program, length, NULL, &log[0]);
+    build->log += string("Linking program:\n") + &log[0] + "\n";
+}
+
+/* Hand both sources to the driver. No status queries here, those would wait for the compile */
+static void submitCompile (ShaderBuild* build)
+{
+    const char* src;
+    build->vertex = glCreateShader(GL_VERTEX_SHADER);
+    src = build->vertex_code.c_str();
+    glShaderSource(build->vertex, 1, &src, NULL);
+    glCompileShader(build->vertex);
+
+    if (build->fragment_path.empty())
+        return;
+    build->fragment = glCreateShader(GL_FRAGMENT_SHADER);
+    src = build->fragment_code.c_str();
+    glShaderSource(build->fragment, 1, &src, NULL);
+    glCompileShader(build->fragment);
+}
+
+static void submitLink (ShaderBuild* build)
+{
+    build->program = glCreateProgram();
+    glAttachShader(build->program, build->vertex);
+    if (build->fragment)
+        glAttachShader(build->program, build->fragment);
+    if (!build->feedback.empty()) {
+        vector<const char*> names;
+        for (size_t i=0; i<build->feedback.size(); i++)
+            names.push_back(build->feedback[i].c_str());
+        glTransformFeedbackVaryings(build->program, names.size(), &names[0], GL_INTERLEAVED_ATTRIBS);
+    }
+    if (build->use_cache)
+        glProgramParameteri(build->program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+    glLinkProgram(build->program);
+    build->link_issued = true;
+}
+
+/* After the link: gather logs, save the binary and drop the shader objects */
+static void completeBuild (ShaderBuild* build)
+{
+    appendShaderLog(build, build->vertex, build->vertex_path);
+    if (build->fragment)
+        appendShaderLog(build, build->fragment, build->fragment_path);
+    appendProgramLog(build);
+
+    GLint linked = GL_FALSE;
+    glGetProgramiv(build->program, GL_LINK_STATUS, &linked);
+    if (linked && build->use_cache)
+        storeCachedProgram(build->program, build->key);
+
+    glDetachShader(build->program, build->vertex);
+    glDeleteShader(build->vertex);
+    if (build->fragment) {
+        glDetachShader(build->program, build->fragment);
+        glDeleteShader(build->fragment);
+    }
+}
+
+static void workerMain (GLFWwindow* context)
+{
+    glfwMakeContextCurrent(context);
+    unique_lock<mutex> lock(worker_lock);
+    for (;;) {
+        while (worker_jobs.empty() && !worker_stop)
+            worker_wake.wait(lock);
+        if (worker_jobs.empty())
+            break;
+        ShaderBuild* build = worker_jobs.front();
+        worker_jobs.pop_front();
+        lock.unlock();
+
+        submitCompile(build);
+        submitLink(build);
+        completeBuild(build);
+        // The program must be complete before another context uses it
+        glFinish();
+
+        lock.lock();
+        build->done = 1;
+        worker_done.notify_all();
+    }
+    glfwMakeContextCurrent(NULL);
+}
+
+void shaderCompilerInit (GLFWwindow* const* shared, int count)
+{
+    if (GLAD_GL_ARB_parallel_shader_compile) {
+        glMaxShaderCompilerThreadsARB(0xFFFFFFFF);     // let the driver pick
+        compile_mode = COMPILE_PARALLEL;
+    }
+    else if (count > 0) {
+        worker_stop = false;
+        for (int i=0; i<count; i++)
+            workers.push_back(thread(workerMain, shared[i]));
+        compile_mode = COMPILE_WORKER;
+    }
+    else
+        compile_mode = COMPILE_SYNC;
+}
+
+void shaderCompilerShutdown ()
+{
+    if (compile_mode == COMPILE_WORKER) {
+        {
+            lock_guard<mutex> lock(worker_lock);
+            worker_stop = true;
+        }
+        worker_wake.notify_all();
+        for (size_t i=0; i<workers.size(); i++)
+            workers[i].join();
+        workers.clear();
+    }
+    compile_mode = COMPILE_SYNC;
+}
+
+static ShaderBuild* newBuild (const char* vertex_file_path, const char* fragment_file_path)
+{
+    ShaderBuild* build = new ShaderBuild();
+    build->vertex_path = vertex_file_path;
+    build->vertex = build->fragment = build->program = 0;
+    build->link_issued = false;
+    build->done = 0;
+    readFile(vertex_file_path, build->vertex_code);
+    if (fragment_file_path) {
+        build->fragment_path = fragment_file_path;
+        readFile(fragment_file_path, build->fragment_code);
+    }
+    return build;
+}
+
+/* Load from the cache or hand the build to the current compile mode */
+static ShaderBuild* startBuild (ShaderBuild* build)
+{
+    build->use_cache = binariesSupported();
+    build->key = 0;
+    if (build->use_cache) {
+        string feedback;
+        for (size_t i=0; i<build->feedback.size(); i++)
+            feedback += build->feedback[i] + " ";
+        build->key = cacheKey(build->vertex_code, build->fragment_code, feedback);
+        build->program = loadCachedProgram(build->key);
+        if (build->program) {
+            build->log = "Loaded cached program for " + build->vertex_path + " + " + build->fragment_path + "\n";
+            build->done = 1;
+            return build;
+        }
+    }
+
+    printf("Compiling shaders : %s %s\n", build->vertex_path.c_str(), build->fragment_path.c_str());
+    switch (compile_mode) {
+        case COMPILE_WORKER: {
+            lock_guard<mutex> lock(worker_lock);
+            worker_jobs.push_back(build);
+            worker_wake.notify_one();
+            break;
+        }
+        case COMPILE_PARALLEL:
+            // Linked by programReady once both shaders report completion, or by finishProgram
+            submitCompile(build);
+            break;
+        default:
+            submitCompile(build);
+            submitLink(build);
+            break;
+    }
+    return build;
+}
+
+ShaderBuild* buildProgramAsync (const char* vertex_file_path, const char* fragment_file_path)
+{
+    return startBuild(newBuild(vertex_file_path, fragment_file_path));
+}
+
+ShaderBuild* buildFeedbackProgramAsync (const char* vertex_file_path, const char* const* varyings, int count)
+{
+    ShaderBuild* build = newBuild(vertex_file_path, NULL);
+    build->feedback.assign(varyings, varyings + count);
+    return startBuild(build);
+}
+
+bool programReady (ShaderBuild* build)
+{
+    if (build->done)
+        return true;
+    if (compile_mode != COMPILE_PARALLEL)
+        return compile_mode == COMPILE_SYNC;
+
+    GLint status = GL_FALSE;
+    if (!build->link_issued) {
+        glGetShaderiv(build->vertex, GL_COMPLETION_STATUS_ARB, &status);
+        if (!status)
+            return false;
+        if (build->fragment) {
+            glGetShaderiv(build->fragment, GL_COMPLETION_STATUS_ARB, &status);
+            if (!status)
+                return false;
+        }
+        submitLink(build);
+    }
+    glGetProgramiv(build->program, GL_COMPLETION_STATUS_ARB, &status);
+    return status == GL_TRUE;
+}
+
+GLuint finishProgram (ShaderBuild* build)
+{
+    if (compile_mode == COMPILE_WORKER) {
+        unique_lock<mutex> lock(worker_lock);
+        while (!build->done)
+            worker_done.wait(lock);
+    }
+    else if (!build->done) {
+        // Any remaining wait happens inside the driver on the first status query
+        if (!build->link_issued)
+            submitLink(build);
+        completeBuild(build);
+        build->done = 1;
+    }
+
+    if (!build->log.empty())
+        fputs(build->log.c_str(), stdout);
+    GLuint program = build->program;
+    delete build;
+    return program;
+}
+
+GLuint LoadShaders (const char* vertex_file_path, const char* fragment_file_path)
+{
+    return finishProgram(buildProgramAsync(vertex_file_path, fragment_file_path));
+}
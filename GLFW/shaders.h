@@ -0,0 +1,46 @@
+#ifndef SHADERS_H
+#define SHADERS_H
+
+#include <glad/glad.h>
+#include <GLFW/glfw3.h>
+
+/* Directory for cached program binaries, NULL turns the cache off */
+void shaderCacheSetDir (const char* dir);
+
+/* Choose how programs are built. With ARB_parallel_shader_compile the driver
+   compiles on its own threads. Otherwise, given 'count' (hidden) windows whose
+   contexts share objects with the main one, a worker thread per window builds
+   programs on it, so up to 'count' build at once. Without either, builds run
+   synchronously. Call with the main context current; shutdown joins the
+   workers before the shared windows may be destroyed. */
+void shaderCompilerInit (GLFWwindow* const* shared, int count);
+void shaderCompilerShutdown ();
+
+/* A program being built. Start every build first, do other setup, then
+   finish them, so startup waits for the slowest shader rather than the sum */
+struct ShaderBuild;
+
+/* Start compiling and linking a vertex + fragment shader pair and return at
+   once. A program found in the binary cache is ready immediately. */
+ShaderBuild* buildProgramAsync (const char* vertex_file_path, const char* fragment_file_path);
+
+/* Same for a vertex shader alone whose outputs 'varyings' are captured,
+   interleaved, by transform feedback (draw with GL_RASTERIZER_DISCARD) */
+ShaderBuild* buildFeedbackProgramAsync (const char* vertex_file_path, const char* const* varyings, int count);
+
+/* True once finishProgram would not block. With ARB_parallel_shader_compile
+   this also issues the link once the shaders have compiled, so poll pending
+   builds during other setup to overlap their links with it */
+bool programReady (ShaderBuild* build);
+
+/* Wait for the build, print its logs and return the program. Frees 'build' */
+GLuint finishProgram (ShaderBuild* build);
+
+/* Compile and link a program from a vertex and a fragment shader file.
+   When the driver can return program binaries, a linked program is stored
+   under a hash of both sources and GL_VENDOR/GL_RENDERER/GL_VERSION, and the
+   next start loads that instead of compiling. A missing, stale or rejected
+   binary just falls back to compiling from source. */
+GLuint LoadShaders (const char* vertex_file_path, const char* fragment_file_path);
+
+#endif
@@ -0,0 +1,427 @@
+/* Tile-based software rasterizer backend
+ *
+ * drawObject() transforms triangles on the calling thread and bins them into
+ * 64x64 tiles, keeping submission order. endFrame() then hands the tiles out
+ * to a pool of workers; each worker clears its tile and walks the triangles
+ * in its bin with SIMD edge functions (8 pixels per step with AVX2, 4 with
+ * SSE2, scalar otherwise). All game geometry sits at z=0 under an ortho
+ * camera, so later triangles simply overwrite earlier ones like GL_LEQUAL
+ * does, and colors interpolate linearly in screen space.
+ */
+#include <algorithm>
+#include <atomic>
+#include <cfloat>
+#include <cmath>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "renderer.h"
+
+using namespace std;
+
+static const int TILE_SIZE = 64;
+
+struct SoftTriangle {
+    int minx, miny, maxx, maxy;     // pixel bounds, clamped to the framebuffer
+    float ea[3], eb[3], ec[3];      // edge functions e = a*x + b*y + c, >= 0 inside
+    float thresh[3];                // 0 for owning edges, FLT_MIN for the others
+    float ca[3], cb[3], cc[3];      // color planes for r,g,b in 0..255
+};
+
+class SoftwareRenderer : public Renderer {
+public:
+    SoftwareRenderer (int width, int height, int threads);
+    ~SoftwareRenderer ();
+
+    bool usesGL () const { return false; }
+    void setClearColor (float r, float g, float b, float a);
+    void resize (int width, int height);
+
+    void beginFrame (bool covered);
+    void drawObject (VAO* vao, const glm::mat4& MVP);
+    void endFrame ();
+
+    void readPixels (int width, int height, unsigned char* rgba);
+
+private:
+    void setupTriangle (const glm::vec4* v, const PackedVertex* const* pv);
+    void rasterTile (int tile);
+    void runTiles ();
+    void workerLoop ();
+
+    int width, height;
+    int stride, rows;               // padded to whole tiles
+    int tiles_x, tiles_y;
+    uint32_t* color;
+    uint32_t clear_color;
+
+    vector<SoftTriangle> tris;
+    vector<vector<uint32_t> > bins;
+    vector<glm::vec4> clip;         // scratch for drawObject
+
+    vector<thread> workers;
+    mutex lock;
+    condition_variable wake, done;
+    int frame_id;
+    bool stopping;
+    atomic<int> next_tile;
+    atomic<int> tiles_done;
+};
+
+static inline uint32_t packColor (float r, float g, float b, float a)
+{
+    return (uint32_t)(r*255.0f + 0.5f) | ((uint32_t)(g*255.0f + 0.5f) << 8) |
+           ((uint32_t)(b*255.0f + 0.5f) << 16) | ((uint32_t)(a*255.0f + 0.5f) << 24);
+}
+
+SoftwareRenderer::SoftwareRenderer (int width, int height, int threads)
+    : color(NULL), clear_color(0xff000000), frame_id(0), stopping(false), next_tile(0), tiles_done(0)
+{
+    resize(width, height);
+
+    if (threads <= 0)
+        threads = max(1u, thread::hardware_concurrency());
+    // The thread calling endFrame() rasterizes tiles too
+    for (int i=1; i<threads; i++)
+        workers.push_back(thread(&SoftwareRenderer::workerLoop, this));
+}
+
+SoftwareRenderer::~SoftwareRenderer ()
+{
+    {
+        lock_guard<mutex> guard(lock);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (size_t i=0; i<workers.size(); i++)
+        workers[i].join();
+    free(color);
+}
+
+void SoftwareRenderer::setClearColor (float r, float g, float b, float a)
+{
+    clear_color = packColor(r, g, b, a);
+}
+
+void SoftwareRenderer::resize (int w, int h)
+{
+    width = w;
+    height = h;
+    tiles_x = (width + TILE_SIZE - 1)/TILE_SIZE;
+    tiles_y = (height + TILE_SIZE - 1)/TILE_SIZE;
+    stride = tiles_x*TILE_SIZE;
+    rows = tiles_y*TILE_SIZE;
+
+    free(color);
+    if (posix_memalign((void**)&color, 64, sizeof(uint32_t)*stride*rows))
+        color = NULL;
+    bins.assign(tiles_x*tiles_y, vector<uint32_t>());
+}
+
+void SoftwareRenderer::beginFrame (bool covered)
+{
+    tris.clear();
+    for (size_t i=0; i<bins.size(); i++)
+        bins[i].clear();
+}
+
+void SoftwareRenderer::setupTriangle (const glm::vec4* v, const PackedVertex* const* pv)
+{
+    float x[3], y[3];
+    for (int i=0; i<3; i++) {
+        // NDC -> window coordinates, y up like the GL viewport
+        x[i] = (v[i].x/v[i].w*0.5f + 0.5f)*width;
+        y[i] = (v[i].y/v[i].w*0.5f + 0.5f)*height;
+    }
+
+    int order[3] = { 0, 1, 2 };
+    float area = (x[1]-x[0])*(y[2]-y[0]) - (x[2]-x[0])*(y[1]-y[0]);
+    if (area == 0)
+        return;
+    if (area < 0) {
+        // Make every triangle counter-clockwise so inside is always e >= 0
+        order[1] = 2;
+        order[2] = 1;
+        area = -area;
+    }
+
+    SoftTriangle t;
+    float fminx = min(x[0], min(x[1], x[2])), fmaxx = max(x[0], max(x[1], x[2]));
+    float fminy = min(y[0], min(y[1], y[2])), fmaxy = max(y[0], max(y[1], y[2]));
+    t.minx = max(0, (int)floorf(fminx));
+    t.miny = max(0, (int)floorf(fminy));
+    t.maxx = min(width-1, (int)ceilf(fmaxx));
+    t.maxy = min(height-1, (int)ceilf(fmaxy));
+    if (t.minx > t.maxx || t.miny > t.maxy)
+        return;
+
+    float inv_area = 1.0f/area;
+    for (int c=0; c<3; c++)
+        t.ca[c] = t.cb[c] = t.cc[c] = 0;
+
+    for (int i=0; i<3; i++) {
+        // Edge opposite vertex i, running from vertex j to vertex k
+        int vi = order[i], vj = order[(i+1)%3], vk = order[(i+2)%3];
+        float a = y[vj] - y[vk];
+        float b = x[vk] - x[vj];
+        float c = x[vj]*y[vk] - y[vj]*x[vk];
+        t.ea[i] = a;
+        t.eb[i] = b;
+        t.ec[i] = c;
+        // Shared edges are owned by exactly one of the two triangles
+        t.thresh[i] = (a > 0 || (a == 0 && b > 0)) ? 0.0f : FLT_MIN;
+
+        for (int ch=0; ch<3; ch++) {
+            float w = pv[vi]->color[ch]*inv_area;
+            t.ca[ch] += a*w;
+            t.cb[ch] += b*w;
+            t.cc[ch] += c*w;
+        }
+    }
+
+    uint32_t index = tris.size();
+    tris.push_back(t);
+
+    int tx0 = t.minx/TILE_SIZE, tx1 = t.maxx/TILE_SIZE;
+    int ty0 = t.miny/TILE_SIZE, ty1 = t.maxy/TILE_SIZE;
+    for (int ty=ty0; ty<=ty1; ty++)
+        for (int tx=tx0; tx<=tx1; tx++)
+            bins[ty*tiles_x + tx].push_back(index);
+}
+
+void SoftwareRenderer::drawObject (VAO* vao, const glm::mat4& MVP)
+{
+    if (vao->PrimitiveMode != GL_TRIANGLES || !color)
+        return;
+
+    // Transform each distinct vertex once, the triangles index into them
+    const float scale = 1.0f/VERTEX_POSITION_SCALE;
+    clip.resize(vao->NumVertices);
+    for (int i=0; i<vao->NumVertices; i++) {
+        const PackedVertex& p = vao->Vertices[i];
+        clip[i] = MVP*glm::vec4(p.x*scale, p.y*scale, 0.0f, 1.0f);
+    }
+
+    const GLushort* idx = &vao->Indices[0];
+    for (int i=0; i+2<vao->NumIndices; i+=3) {
+        glm::vec4 v[3];
+        const PackedVertex* pv[3];
+        bool visible = true;
+        for (int k=0; k<3; k++) {
+            v[k] = clip[idx[i+k]];
+            pv[k] = &vao->Vertices[idx[i+k]];
+            if (v[k].w <= 0)
+                visible = false;
+        }
+        if (visible)
+            setupTriangle(v, pv);
+    }
+}
+
+#if defined(__AVX2__)
+
+/* 8 pixels per step */
+static void rasterSpan (const SoftTriangle& t, uint32_t* row, int x0, int x1, float py)
+{
+    const __m256 step = _mm256_set_ps(7.5f, 6.5f, 5.5f, 4.5f, 3.5f, 2.5f, 1.5f, 0.5f);
+    __m256 e_row[3], e_a[3], th[3], c_row[3], c_a[3];
+    for (int i=0; i<3; i++) {
+        e_a[i] = _mm256_set1_ps(t.ea[i]);
+        e_row[i] = _mm256_set1_ps(t.eb[i]*py + t.ec[i]);
+        th[i] = _mm256_set1_ps(t.thresh[i]);
+        c_a[i] = _mm256_set1_ps(t.ca[i]);
+        c_row[i] = _mm256_set1_ps(t.cb[i]*py + t.cc[i]);
+    }
+    const __m256 zero = _mm256_setzero_ps(), full = _mm256_set1_ps(255.0f);
+    const __m256i alpha = _mm256_set1_epi32(0xff000000);
+    const __m256i lane = _mm256_set_epi32(7, 6, 5, 4, 3, 2, 1, 0);
+
+    for (int x=x0 & ~7; x<=x1; x+=8) {
+        __m256 px = _mm256_add_ps(_mm256_set1_ps((float)x), step);
+        __m256 inside = _mm256_castsi256_ps(_mm256_cmpeq_epi32(lane, lane));
+        for (int i=0; i<3; i++) {
+            __m256 e = _mm256_add_ps(_mm256_mul_ps(e_a[i], px), e_row[i]);
+            inside = _mm256_and_ps(inside, _mm256_cmp_ps(e, th[i], _CMP_GE_OQ));
+        }
+        // Clip to [x0, x1]
+        __m256i xi = _mm256_add_epi32(_mm256_set1_epi32(x), lane);
+        __m256i span = _mm256_and_si256(_mm256_cmpgt_epi32(xi, _mm256_set1_epi32(x0-1)),
+                                        _mm256_cmpgt_epi32(_mm256_set1_epi32(x1+1), xi));
+        __m256i mask = _mm256_and_si256(_mm256_castps_si256(inside), span);
+        if (_mm256_testz_si256(mask, mask))
+            continue;
+
+        __m256i rgb[3];
+        for (int i=0; i<3; i++) {
+            __m256 c = _mm256_add_ps(_mm256_mul_ps(c_a[i], px), c_row[i]);
+            c = _mm256_min_ps(_mm256_max_ps(c, zero), full);
+            rgb[i] = _mm256_slli_epi32(_mm256_cvtps_epi32(c), 8*i);
+        }
+        __m256i pixel = _mm256_or_si256(_mm256_or_si256(rgb[0], rgb[1]), _mm256_or_si256(rgb[2], alpha));
+
+        __m256i* dst = (__m256i*)(row + x);
+        _mm256_store_si256(dst, _mm256_blendv_epi8(_mm256_load_si256(dst), pixel, mask));
+    }
+}
+
+#elif defined(__SSE2__)
+
+/* 4 pixels per step */
+static void rasterSpan (const SoftTriangle& t, uint32_t* row, int x0, int x1, float py)
+{
+    const __m128 step = _mm_set_ps(3.5f, 2.5f, 1.5f, 0.5f);
+    __m128 e_row[3], e_a[3], th[3], c_row[3], c_a[3];
+    for (int i=0; i<3; i++) {
+        e_a[i] = _mm_set1_ps(t.ea[i]);
+        e_row[i] = _mm_set1_ps(t.eb[i]*py + t.ec[i]);
+        th[i] = _mm_set1_ps(t.thresh[i]);
+        c_a[i] = _mm_set1_ps(t.ca[i]);
+        c_row[i] = _mm_set1_ps(t.cb[i]*py + t.cc[i]);
+    }
+    const __m128 zero = _mm_setzero_ps(), full = _mm_set1_ps(255.0f);
+    const __m128i alpha = _mm_set1_epi32(0xff000000);
+    const __m128i lane = _mm_set_epi32(3, 2, 1, 0);
+
+    for (int x=x0 & ~3; x<=x1; x+=4) {
+        __m128 px = _mm_add_ps(_mm_set1_ps((float)x), step);
+        __m128 inside = _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(e_a[0], px), e_row[0]), th[0]);
+        inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(e_a[1], px), e_row[1]), th[1]));
+        inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(e_a[2], px), e_row[2]), th[2]));
+
+        // Clip to [x0, x1]
+        __m128i xi = _mm_add_epi32(_mm_set1_epi32(x), lane);
+        __m128i span = _mm_and_si128(_mm_cmpgt_epi32(xi, _mm_set1_epi32(x0-1)),
+                                     _mm_cmplt_epi32(xi, _mm_set1_epi32(x1+1)));
+        __m128i mask = _mm_and_si128(_mm_castps_si128(inside), span);
+        if (_mm_movemask_epi8(mask) == 0)
+            continue;
+
+        __m128i rgb[3];
+        for (int i=0; i<3; i++) {
+            __m128 c = _mm_add_ps(_mm_mul_ps(c_a[i], px), c_row[i]);
+            c = _mm_min_ps(_mm_max_ps(c, zero), full);
+            rgb[i] = _mm_slli_epi32(_mm_cvtps_epi32(c), 8*i);
+        }
+        __m128i pixel = _mm_or_si128(_mm_or_si128(rgb[0], rgb[1]), _mm_or_si128(rgb[2], alpha));
+
+        __m128i* dst = (__m128i*)(row + x);
+        __m128i old = _mm_load_si128(dst);
+        _mm_store_si128(dst, _mm_or_si128(_mm_and_si128(mask, pixel), _mm_andnot_si128(mask, old)));
+    }
+}
+
+#else
+
+static void rasterSpan (const SoftTriangle& t, uint32_t* row, int x0, int x1, float py)
+{
+    for (int x=x0; x<=x1; x++) {
+        float px = x + 0.5f;
+        bool inside = true;
+        for (int i=0; i<3; i++)
+            if (t.ea[i]*px + t.eb[i]*py + t.ec[i] < t.thresh[i])
+                inside = false;
+        if (!inside)
+            continue;
+
+        uint32_t pixel = 0xff000000;
+        for (int i=0; i<3; i++) {
+            float c = t.ca[i]*px + t.cb[i]*py + t.cc[i];
+            c = min(max(c, 0.0f), 255.0f);
+            pixel |= (uint32_t)lrintf(c) << (8*i);
+        }
+        row[x] = pixel;
+    }
+}
+
+#endif
+
+void SoftwareRenderer::rasterTile (int tile)
+{
+    int tx = tile % tiles_x, ty = tile / tiles_x;
+    int left = tx*TILE_SIZE, bottom = ty*TILE_SIZE;
+    int right = left + TILE_SIZE - 1, top = bottom + TILE_SIZE - 1;
+
+    for (int y=bottom; y<=top; y++) {
+        uint32_t* row = color + y*stride;
+        fill(row + left, row + right + 1, clear_color);
+    }
+
+    const vector<uint32_t>& bin = bins[tile];
+    for (size_t i=0; i<bin.size(); i++) {
+        const SoftTriangle& t = tris[bin[i]];
+        int x0 = max(left, t.minx), x1 = min(right, t.maxx);
+        int y0 = max(bottom, t.miny), y1 = min(top, t.maxy);
+        for (int y=y0; y<=y1; y++)
+            rasterSpan(t, color + y*stride, x0, x1, y + 0.5f);
+    }
+}
+
+void SoftwareRenderer::runTiles ()
+{
+    int count = tiles_x*tiles_y;
+    for (int tile = next_tile++; tile < count; tile = next_tile++) {
+        rasterTile(tile);
+        if (++tiles_done == count) {
+            lock_guard<mutex> guard(lock);
+            done.notify_all();
+        }
+    }
+}
+
+void SoftwareRenderer::workerLoop ()
+{
+    int seen = 0;
+    for (;;) {
+        {
+            unique_lock<mutex> guard(lock);
+            while (!stopping && frame_id == seen)
+                wake.wait(guard);
+            if (stopping)
+                return;
+            seen = frame_id;
+        }
+        runTiles();
+    }
+}
+
+void SoftwareRenderer::endFrame ()
+{
+    if (!color)
+        return;
+
+    {
+        lock_guard<mutex> guard(lock);
+        next_tile = 0;
+        tiles_done = 0;
+        frame_id++;
+    }
+    wake.notify_all();
+    runTiles();
+
+    unique_lock<mutex> guard(lock);
+    while (tiles_done < tiles_x*tiles_y)
+        done.wait(guard);
+}
+
+void SoftwareRenderer::readPixels (int w, int h, unsigned char* rgba)
+{
+    w = min(w, width);
+    h = min(h, height);
+    for (int y=0; y<h; y++)
+        memcpy(rgba + 4*y*w, color + y*stride, 4*w);
+}
+
+Renderer* createSoftwareRenderer (int width, int height, int threads)
+{
+    return new SoftwareRenderer(width, height, threads);
+}
@@ -0,0 +1,120 @@
+#ifndef SPSC_QUEUE_H
+#define SPSC_QUEUE_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+
+/* Bounded lock-free queue for exactly one producer thread and one consumer
+   thread. SIZE must be a power of two. head and tail only ever grow and are
+   masked on access, so a full queue and an empty one are told apart by
+   tail - head. They live on separate cache lines to avoid false sharing. */
+template <typename T, unsigned SIZE>
+class SPSCQueue {
+public:
+    SPSCQueue () : head(0), tail(0) {}
+
+    /* Producer: returns false (and drops the item) when full */
+    bool push (const T& item)
+    {
+        unsigned t = tail.load(std::memory_order_relaxed);
+        if (t - head.load(std::memory_order_acquire) == SIZE)
+            return false;
+        items[t & (SIZE-1)] = item;
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    /* Consumer: look at the oldest item without removing it */
+    bool peek (T& item) const
+    {
+        unsigned h = head.load(std::memory_order_relaxed);
+        if (h == tail.load(std::memory_order_acquire))
+            return false;
+        item = items[h & (SIZE-1)];
+        return true;
+    }
+
+    /* Consumer: remove the oldest item */
+    bool pop (T& item)
+    {
+        if (!peek(item))
+            return false;
+        head.store(head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+        return true;
+    }
+
+    /* Approximate, only exact when called from the consumer or producer */
+    unsigned size () const
+    {
+        return tail.load(std::memory_order_acquire) - head.load(std::memory_order_acquire);
+    }
+
+private:
+    T items[SIZE];
+    alignas(64) std::atomic<unsigned> head;     // next slot to read
+    alignas(64) std::atomic<unsigned> tail;     // next slot to write
+};
+
+/* The same for a stream of plain values moved in bulk, sized at run time.
+   allocate() is the only call that allocates; the rest copy in at most
+   two pieces around the wrap. */
+template <typename T>
+class SPSCRing {
+public:
+    SPSCRing () : items(NULL), mask(0), head(0), tail(0) {}
+    ~SPSCRing () { delete[] items; }
+
+    /* Neither thread may be using the ring. Rounds up to a power of two */
+    void allocate (size_t capacity)
+    {
+        size_t size = 1;
+        while (size < capacity)
+            size *= 2;
+        delete[] items;
+        items = new T[size];
+        mask = size - 1;
+        head = 0;
+        tail = 0;
+    }
+
+    size_t capacity () const { return items ? mask + 1 : 0; }
+
+    /* Producer: copies what fits, returns how many */
+    size_t write (const T* from, size_t count)
+    {
+        size_t t = tail.load(std::memory_order_relaxed);
+        count = std::min(count, capacity() - (t - head.load(std::memory_order_acquire)));
+        size_t first = std::min(count, capacity() - (t & mask));
+        std::copy(from, from + first, items + (t & mask));
+        std::copy(from + first, from + count, items);
+        tail.store(t + count, std::memory_order_release);
+        return count;
+    }
+
+    /* Consumer: copies out what is there, returns how many */
+    size_t read (T* to, size_t count)
+    {
+        size_t h = head.load(std::memory_order_relaxed);
+        count = std::min(count, tail.load(std::memory_order_acquire) - h);
+        size_t first = std::min(count, capacity() - (h & mask));
+        std::copy(items + (h & mask), items + (h & mask) + first, to);
+        std::copy(items, items + (count - first), to + first);
+        head.store(h + count, std::memory_order_release);
+        return count;
+    }
+
+    /* Approximate, like SPSCQueue::size */
+    size_t size () const
+    {
+        return tail.load(std::memory_order_acquire) - head.load(std::memory_order_acquire);
+    }
+
+private:
+    T* items;
+    size_t mask;
+    alignas(64) std::atomic<size_t> head;
+    alignas(64) std::atomic<size_t> tail;
+};
+
+#endif
@@ -0,0 +1,108 @@
+#include <cmath>
+#include <cstddef>
+#include <cstring>
+#include <vector>
+
+#include "text.h"
+
+using namespace std;
+
+/* Per instance data: where the glyph goes and which segments it lights */
+struct TextGlyph {
+    GLfloat x, y, scale;
+    GLuint mask;
+};
+
+static GLuint text_program = 0;
+static GLuint text_vao = 0;
+static GLuint text_buffer = 0;
+static GLint text_vp = -1;
+static GLint text_color = -1;
+static float text_height = 1;
+
+static unsigned int glyph_masks[256];
+static float glyph_advance[256];
+static vector<TextGlyph> instances;
+
+void textInit (GLuint program, const TextSegment* segments, int count, float glyph_height)
+{
+    if (count > TEXT_MAX_SEGMENTS)
+        count = TEXT_MAX_SEGMENTS;
+    text_program = program;
+    text_height = glyph_height;
+    memset(glyph_masks, 0, sizeof(glyph_masks));
+    memset(glyph_advance, 0, sizeof(glyph_advance));
+
+    // The shader wants each segment as center + unit axis, and half extents along/across it
+    GLfloat lines[TEXT_MAX_SEGMENTS*4];
+    GLfloat sizes[TEXT_MAX_SEGMENTS*2];
+    float extent_x = 0, extent_y = 0;
+    for (int i=0; i<count; i++) {
+        const TextSegment& s = segments[i];
+        float dx = s.bx - s.ax, dy = s.by - s.ay;
+        float length = sqrt(dx*dx + dy*dy);
+        lines[4*i+0] = (s.ax + s.bx)*0.5f;
+        lines[4*i+1] = (s.ay + s.by)*0.5f;
+        lines[4*i+2] = length > 0 ? dx/length : 1;
+        lines[4*i+3] = length > 0 ? dy/length : 0;
+        sizes[2*i+0] = length*0.5f;
+        sizes[2*i+1] = s.half_width;
+
+        // The quad has to cover the thick ends of every segment
+        extent_x = fmax(extent_x, fmax(fabs(s.ax), fabs(s.bx)) + s.half_width);
+        extent_y = fmax(extent_y, fmax(fabs(s.ay), fabs(s.by)) + s.half_width);
+    }
+
+    glUseProgram(program);
+    glUniform4fv(glGetUniformLocation(program, "segmentLine"), count, lines);
+    glUniform2fv(glGetUniformLocation(program, "segmentSize"), count, sizes);
+    glUniform1i(glGetUniformLocation(program, "segmentCount"), count);
+    glUniform2f(glGetUniformLocation(program, "extent"), extent_x + 1, extent_y + 1);
+    text_vp = glGetUniformLocation(program, "VP");
+    text_color = glGetUniformLocation(program, "textColor");
+
+    if (!text_vao) {
+        glGenVertexArrays(1, &text_vao);
+        glGenBuffers(1, &text_buffer);
+    }
+    glBindVertexArray(text_vao);
+    glBindBuffer(GL_ARRAY_BUFFER, text_buffer);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(TextGlyph), (void*)offsetof(TextGlyph, x));
+    glVertexAttribDivisor(0, 1);
+    glEnableVertexAttribArray(1);
+    glVertexAttribIPointer(1, 1, GL_UNSIGNED_INT, sizeof(TextGlyph), (void*)offsetof(TextGlyph, mask));
+    glVertexAttribDivisor(1, 1);
+    glBindVertexArray(0);
+}
+
+void textSetGlyph (unsigned char c, unsigned int mask, float advance)
+{
+    glyph_masks[c] = mask;
+    glyph_advance[c] = advance;
+}
+
+void textDraw (const char* text, float x, float y, float size, const glm::mat4& VP, float r, float g, float b)
+{
+    float scale = size/text_height;
+    instances.clear();
+    for (const unsigned char* c=(const unsigned char*)text; *c; c++) {
+        if (glyph_masks[*c]) {
+            TextGlyph glyph = { x, y, scale, glyph_masks[*c] };
+            instances.push_back(glyph);
+        }
+        x += glyph_advance[*c]*scale;
+    }
+    if (instances.empty())
+        return;
+
+    glUseProgram(text_program);
+    glUniformMatrix4fv(text_vp, 1, GL_FALSE, &VP[0][0]);
+    glUniform3f(text_color, r, g, b);
+
+    glBindVertexArray(text_vao);
+    glBindBuffer(GL_ARRAY_BUFFER, text_buffer);
+    glBufferData(GL_ARRAY_BUFFER, instances.size()*sizeof(TextGlyph), &instances[0], GL_STREAM_DRAW);
+    glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+    glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, instances.size());
+}
@@ -0,0 +1,31 @@
+#ifndef TEXT_H
+#define TEXT_H
+
+#include <glad/glad.h>
+
+#define GLM_FORCE_RADIANS
+#include <glm/glm.hpp>
+
+static const int TEXT_MAX_SEGMENTS = 32;    // one bit each in a glyph mask
+
+/* A stroke of the segment font: a rectangle around the line a-b (which may
+   be a point), 2*half_width thick. Glyph units, origin at the glyph center. */
+struct TextSegment {
+    float ax, ay, bx, by;
+    float half_width;
+};
+
+/* Font for the program built from Text.vert/Text.frag. Glyphs are set
+   afterwards with textSetGlyph, unset characters draw nothing. */
+void textInit (GLuint program, const TextSegment* segments, int count, float glyph_height);
+
+/* Bit i of mask lights segments[i]. advance is in glyph units */
+void textSetGlyph (unsigned char c, unsigned int mask, float advance);
+
+/* Draw 'text' starting with the first glyph centered on (x,y), size being the
+   glyph height in world units. Each character is one quad whose fragment
+   shader tests the lit segments' distance fields, so the whole string is a
+   single instanced draw. */
+void textDraw (const char* text, float x, float y, float size, const glm::mat4& VP, float r, float g, float b);
+
+#endif
@@ -121,6 +121,16 @@ int                   ao_play(ao_device *device,
                               uint_32 num_bytes);
 int                  ao_close(ao_device *device);
 
+/* asynchronous playback */
+int            ao_async_start(ao_device *device,
+                              uint_32 buffer_bytes);
+int             ao_async_play(ao_device *device,
+                              char *output_samples,
+                              uint_32 num_bytes);
+uint_32        ao_async_space(ao_device *device);
+uint_32      ao_async_latency(ao_device *device);
+uint_32    ao_async_underruns(ao_device *device);
+
 /* driver information */
 int              ao_driver_id(const char *short_name);
 int      ao_default_driver_id(void);
@@ -56,11 +56,15 @@
 #ifndef AO_USER_CONFIG
 #define AO_USER_CONFIG   "/.libao"
 #endif
+#ifndef AO_PLUGIN_CACHE
+#define AO_PLUGIN_CACHE  "/.libao-plugins"
+#endif
 
 /* --- Structures --- */
 
 typedef struct ao_config {
 	char *default_driver;
+	char *plugin_cache;   /* NULL for the default, "no" for none */
 } ao_config;
 
 typedef enum {
@@ -70,6 +74,10 @@ typedef enum {
   AO_OUTPUT_MATRIX_PERMUTABLE=3,  /* channel map is fully permutable. eg Pulse */
 } ao_outorder;
 
+typedef struct ao_async ao_async;
+typedef struct ao_file_buffer ao_file_buffer;
+typedef struct ao_resampler ao_resampler;
+
 struct ao_device {
 	int  type; /* live output or file output? */
 	int  driver_id;
@@ -118,6 +126,22 @@ struct ao_device {
 	void *internal;       /* Pointer to driver-specific data */
 
         int verbose;
+
+        /* converts whole frames from the client buffer into
+           swap_buffer, chosen by ao_open for this format. NULL when
+           ao_play can pass the client buffer through untouched. */
+        void (*convert)(ao_device *device, char *target,
+                        const char *source, int frames);
+
+        ao_async *async;      /* ring buffer and writer thread after
+                                 ao_async_start, otherwise NULL */
+
+        int output_rate;      /* rate the driver runs at. Starts as
+                                 rate; a driver's open may change it,
+                                 and ao_play then resamples */
+        int resample_quality; /* the "resample" option: 0 fast, 1
+                                 medium, 2 best, -1 off */
+        ao_resampler *resampler; /* NULL unless the rates differ */
 };
 
 struct ao_functions {
@@ -138,6 +162,18 @@ struct ao_functions {
 
 void ao_read_config_files (ao_config *config);
 
+/* Output path of the wav and raw drivers, in file_buffer.c. Writes
+   go through an aligned buffer of 'size' bytes (AO_FILE_BUF_SIZE when
+   0), or with use_mmap into the file mapped a window of that size at
+   a time. Close flushes, and reports the final file size. */
+#define AO_FILE_BUF_SIZE (1024*1024)
+
+ao_file_buffer *ao_file_buffer_open (ao_device *device, uint_32 size,
+				     int use_mmap);
+int ao_file_buffer_write (ao_file_buffer *fb, const char *data,
+			  uint_32 num_bytes);
+int ao_file_buffer_close (ao_file_buffer *fb, long *size);
+
 #define adebug(format, args...) {\
     if(device->verbose==2){                                             \
       if(strcmp(format,"\n")){                                          \
@@ -32,8 +32,9 @@
 #include <errno.h>
 #include <ao/ao.h>
 #include <ao/plugin.h>
+#include "ao_private.h"
 
-static char *ao_raw_options[] = {"byteorder","matrix","verbose","quiet","debug"};
+static char *ao_raw_options[] = {"byteorder","buffer_size","use_mmap","rate","matrix","verbose","quiet","debug"};
 static ao_info ao_raw_info =
 {
 	AO_TYPE_FILE,
@@ -50,6 +51,10 @@ static ao_info ao_raw_info =
 typedef struct ao_raw_internal
 {
 	int byte_order;
+	ao_file_buffer *out;
+	uint_32 buffer_size;
+	int use_mmap;
+	int rate;
 } ao_raw_internal;
 
 
@@ -75,6 +80,10 @@ static int ao_raw_device_init(ao_device *device)
 		return 0; /* Could not initialize device memory */
 
 	internal->byte_order = AO_FMT_NATIVE;
+	internal->out = NULL;
+	internal->buffer_size = 0;
+	internal->use_mmap = 0;
+	internal->rate = 0;
 
 	device->internal = internal;
         device->output_matrix_order = AO_OUTPUT_MATRIX_FIXED;
@@ -97,6 +106,19 @@ static int ao_raw_set_option(ao_device *device, const char *key,
 		else
 			return 0; /* Bad option value */
 	}
+	else if (!strcmp(key, "buffer_size")) {
+		internal->buffer_size = atoi(value);
+	}
+	else if (!strcmp(key, "use_mmap")) {
+		internal->use_mmap = !strcmp(value,"yes") || !strcmp(value,"y") ||
+			!strcmp(value,"true") || !strcmp(value,"t") ||
+			!strcmp(value,"1");
+	}
+	else if (!strcmp(key, "rate")) {
+		internal->rate = atoi(value);
+		if (internal->rate <= 0)
+			return 0; /* Bad option value */
+	}
 
 	return 1;
 }
@@ -107,6 +129,13 @@ static int ao_raw_open(ao_device *device, ao_sample_format *format)
 	ao_raw_internal *internal = (ao_raw_internal *)device->internal;
 
 	device->driver_byte_format = internal->byte_order;
+	if (internal->rate)
+		device->output_rate = internal->rate;
+
+	internal->out = ao_file_buffer_open(device, internal->buffer_size,
+					    internal->use_mmap);
+	if (internal->out == NULL)
+		return 0;
 
         //if(!device->inter_matrix){
         ///* by default, inter == in */
@@ -124,18 +153,19 @@ static int ao_raw_open(ao_device *device, ao_sample_format *format)
 static int ao_raw_play(ao_device *device, const char *output_samples,
 		       uint_32 num_bytes)
 {
-	if (fwrite(output_samples, sizeof(char), num_bytes,
-		   device->file) < num_bytes)
-		return 0;
-	else
-		return 1;
+	ao_raw_internal *internal = (ao_raw_internal *)device->internal;
+
+	return ao_file_buffer_write(internal->out, output_samples, num_bytes);
 }
 
 
 static int ao_raw_close(ao_device *device)
 {
-	/* No closeout needed */
-	return 1;
+	ao_raw_internal *internal = (ao_raw_internal *)device->internal;
+	int result = ao_file_buffer_close(internal->out, NULL);
+
+	internal->out = NULL;
+	return result;
 }
 
 
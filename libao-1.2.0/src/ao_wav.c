@@ -35,6 +35,7 @@
 #include <string.h>
 #include <signal.h>
 #include <ao/ao.h>
+#include "ao_private.h"
 
 #define WAVE_FORMAT_PCM         0x0001
 #define FORMAT_MULAW            0x0101
@@ -90,7 +91,7 @@ struct wave_header
 };
 
 
-static char *ao_wav_options[] = {"matrix","verbose","quiet","debug"};
+static char *ao_wav_options[] = {"buffer_size","use_mmap","rate","matrix","verbose","quiet","debug"};
 static ao_info ao_wav_info =
 {
 	AO_TYPE_FILE,
@@ -107,6 +108,10 @@ static ao_info ao_wav_info =
 typedef struct ao_wav_internal
 {
 	struct wave_header wave;
+	ao_file_buffer *out;
+	uint_32 buffer_size;
+	int use_mmap;
+	int rate;
 } ao_wav_internal;
 
 
@@ -132,6 +137,10 @@ static int ao_wav_device_init(ao_device *device)
 		return 0; /* Could not initialize device memory */
 
 	memset(&(internal->wave), 0, sizeof(internal->wave));
+	internal->out = NULL;
+	internal->buffer_size = 0;
+	internal->use_mmap = 0;
+	internal->rate = 0;
 
 	device->internal = internal;
         device->output_matrix = strdup("L,R,C,LFE,BL,BR,CL,CR,BC,SL,SR");
@@ -144,7 +153,23 @@ static int ao_wav_device_init(ao_device *device)
 static int ao_wav_set_option(ao_device *device, const char *key,
 			     const char *value)
 {
-	return 1; /* No options! */
+	ao_wav_internal *internal = (ao_wav_internal *) device->internal;
+
+	if (!strcmp(key, "buffer_size")) {
+		internal->buffer_size = atoi(value);
+	}
+	else if (!strcmp(key, "use_mmap")) {
+		internal->use_mmap = !strcmp(value,"yes") || !strcmp(value,"y") ||
+			!strcmp(value,"true") || !strcmp(value,"t") ||
+			!strcmp(value,"1");
+	}
+	else if (!strcmp(key, "rate")) {
+		internal->rate = atoi(value);
+		if (internal->rate <= 0)
+			return 0; /* Bad option value */
+	}
+
+	return 1;
 }
 
 static int ao_wav_open(ao_device *device, ao_sample_format *format)
@@ -153,11 +178,15 @@ static int ao_wav_open(ao_device *device, ao_sample_format *format)
 	unsigned char buf[WAV_HEADER_LEN];
 	int size = 0x7fffffff; /* Use a bogus size initially */
 
+	/* Written at another rate than the client's, ao_play resamples */
+	if (internal->rate)
+		device->output_rate = internal->rate;
+
 	/* Store information */
 	internal->wave.common.wChannels = device->output_channels;
 	internal->wave.common.wBitsPerSample = ((format->bits+7)>>3)<<3;
 	internal->wave.common.wValidBitsPerSample = format->bits;
-	internal->wave.common.dwSamplesPerSec = format->rate;
+	internal->wave.common.dwSamplesPerSec = device->output_rate;
 
 	memset(buf, 0, WAV_HEADER_LEN);
 
@@ -205,8 +234,14 @@ static int ao_wav_open(ao_device *device, ao_sample_format *format)
 	strncpy(buf+60, internal->wave.data.id, 4);
 	WRITE_U32(buf+64, internal->wave.data.len);
 
-	if (fwrite(buf, sizeof(char), WAV_HEADER_LEN, device->file)
-	    != WAV_HEADER_LEN) {
+	internal->out = ao_file_buffer_open(device, internal->buffer_size,
+					    internal->use_mmap);
+	if (internal->out == NULL)
+		return 0;
+
+	if (!ao_file_buffer_write(internal->out, (char *)buf, WAV_HEADER_LEN)) {
+		ao_file_buffer_close(internal->out, NULL);
+		internal->out = NULL;
 		return 0; /* Could not write wav header */
 	}
 
@@ -222,12 +257,9 @@ static int ao_wav_open(ao_device *device, ao_sample_format *format)
 static int ao_wav_play(ao_device *device, const char *output_samples,
 			uint_32 num_bytes)
 {
-	if (fwrite(output_samples, sizeof(char), num_bytes,
-		   device->file) < num_bytes)
-		return 0;
-	else
-		return 1;
+	ao_wav_internal *internal = (ao_wav_internal *) device->internal;
 
+	return ao_file_buffer_write(internal->out, output_samples, num_bytes);
 }
 
 static int ao_wav_close(ao_device *device)
@@ -237,12 +269,13 @@ static int ao_wav_close(ao_device *device)
 
 	long size;
 
-	/* Find how long our file is in total, including header */
-	size = ftell(device->file);
-
-	if (size < 0) {
+	/* Write out what is buffered, and find how long our file is in
+	   total, including header */
+	if (!ao_file_buffer_close(internal->out, &size)) {
+		internal->out = NULL;
 		return 0;  /* Wav header corrupt */
 	}
+	internal->out = NULL;
 
 	/* Go back and set correct length info */
 
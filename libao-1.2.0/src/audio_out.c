@@ -34,6 +34,16 @@
 #include <string.h>
 #include <ctype.h>
 #include <limits.h>
+#include <math.h>
+#ifdef HAVE_LIBPTHREAD
+# include <pthread.h>
+#endif
+#if defined(__SSE2__)
+# include <emmintrin.h>
+#endif
+#if defined(__SSSE3__)
+# include <tmmintrin.h>
+#endif
 #if defined HAVE_DLFCN_H && defined HAVE_DLOPEN
 # include <dlfcn.h>
 #else
@@ -64,12 +74,16 @@ static int dlclose(void *handle) { return 0; }
 
 /* --- Other constants --- */
 #define DEF_SWAP_BUF_SIZE  1024
+#define DEF_ASYNC_BUF_MS   200   /* ring size when ao_async_start gets 0 */
+#define ASYNC_CHUNKS       4     /* the writer plays at most a quarter ring at once */
 
 /* --- Driver Table --- */
 
 typedef struct driver_list {
-	ao_functions *functions;
+	ao_functions *functions;  /* NULL until a cached plugin is loaded */
 	void *handle;
+	char *path;               /* plugin file */
+	ao_info *info;            /* from the plugin cache, else NULL */
 	struct driver_list *next;
 } driver_list;
 
@@ -101,7 +115,8 @@ static ao_functions *static_drivers[] = {
 
 static driver_list *driver_head = NULL;
 static ao_config config = {
-	NULL /* default_driver */
+	NULL, /* default_driver */
+	NULL  /* plugin_cache */
 };
 
 static ao_info **info_table = NULL;
@@ -125,6 +140,8 @@ static void _clear_config()
 
 	free(config.default_driver);
 	config.default_driver = NULL;
+	free(config.plugin_cache);
+	config.plugin_cache = NULL;
 }
 
 
@@ -205,6 +222,362 @@ static driver_list *_get_plugin(char *plugin_file)
 }
 
 
+/* ---------- Plugin registry cache ---------- */
+
+/* A full scan dlopens every plugin, with all the sound system libraries
+   behind them, just to read its ao_info. The scan's results are kept in
+   a cache file (~/.libao-plugins unless plugin_cache says otherwise);
+   while the plugin directory and files still match it, plugins start out
+   as just a path and their info, and are only loaded once a device is
+   opened on them or they are tested as the default. Anything that does
+   not match sends ao_initialize back to the full scan, which rewrites
+   the cache. */
+
+#define PLUGIN_CACHE_VERSION "libao plugin cache 1"
+#define PLUGIN_CACHE_LINE    1024
+
+#ifdef HAVE_LIBPTHREAD
+static pthread_mutex_t plugin_mutex = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+static ao_info *_driver_info(const driver_list *driver)
+{
+	if (driver->info)
+		return driver->info;
+	return driver->functions->driver_info();
+}
+
+static void _free_info(ao_info *info)
+{
+	int i;
+
+	if (info == NULL) return;
+
+	free(info->name);
+	free(info->short_name);
+	free(info->author);
+	free(info->comment);
+	for (i = 0; i < info->option_count; i++)
+		free(info->options[i]);
+	free(info->options);
+	free(info);
+}
+
+/* Path of the cache file in buffer, or 0 when there is none */
+static int _plugin_cache_path(char *buffer, int size)
+{
+	char *homedir;
+
+	if (config.plugin_cache != NULL) {
+		if (*config.plugin_cache == 0 ||
+		    strcmp(config.plugin_cache, "no") == 0)
+			return 0;
+		return snprintf(buffer, size, "%s", config.plugin_cache) < size;
+	}
+
+	homedir = getenv("HOME");
+	if (homedir == NULL)
+		return 0;
+	return snprintf(buffer, size, "%s%s", homedir, AO_PLUGIN_CACHE) < size;
+}
+
+static void _remove_plugin_cache(void)
+{
+	char path[FILENAME_MAX+1];
+
+	if (_plugin_cache_path(path, sizeof(path)))
+		unlink(path);
+}
+
+/* dlopen a cached plugin the first time it is needed. Returns 0 if it
+   can't be loaded any more, in which case the next ao_initialize scans
+   again. */
+static int _load_driver(driver_list *driver)
+{
+        ao_device *device = ao_global_dummy;
+	driver_list *plugin;
+	int ok = 1;
+
+#ifdef HAVE_LIBPTHREAD
+	pthread_mutex_lock(&plugin_mutex);
+#endif
+	if (driver->functions == NULL) {
+		plugin = _get_plugin(driver->path);
+		if (plugin &&
+		    strcmp(plugin->functions->driver_info()->short_name,
+			   driver->info->short_name) != 0) {
+			aerror("Plugin %s is no longer driver %s\n",
+			       driver->path, driver->info->short_name);
+			dlclose(plugin->handle);
+			free(plugin->functions);
+			free(plugin);
+			plugin = NULL;
+		}
+
+		if (plugin) {
+			driver->handle = plugin->handle;
+			driver->functions = plugin->functions;
+			free(plugin);
+		} else {
+			_remove_plugin_cache();
+			ok = 0;
+		}
+	}
+#ifdef HAVE_LIBPTHREAD
+	pthread_mutex_unlock(&plugin_mutex);
+#endif
+
+	return ok;
+}
+
+/* Strings go one per line, so one with a newline can't be cached */
+static int _cache_string(FILE *fp, const char *key, const char *value)
+{
+	if (value == NULL)
+		return 1;
+	if (strchr(value, '\n') || strlen(key) + strlen(value) + 3 > PLUGIN_CACHE_LINE)
+		return 0;
+	return fprintf(fp, "%s %s\n", key, value) > 0;
+}
+
+/* Record the plugins from a full scan. dir_mtime is the plugin
+   directory's before the scan. */
+static void _write_plugin_cache(driver_list *plugins, time_t dir_mtime)
+{
+        ao_device *device = ao_global_dummy;
+	char path[FILENAME_MAX+1];
+	char temp[FILENAME_MAX+32];
+	struct stat statbuf;
+	driver_list *driver;
+	ao_info *info;
+	FILE *fp;
+	int ok, i;
+
+	if (!_plugin_cache_path(path, sizeof(path)))
+		return;
+
+	/* Written aside and renamed, so concurrent starts never read half
+	   a cache */
+	snprintf(temp, sizeof(temp), "%s.%ld", path, (long)getpid());
+	if ( !(fp = fopen(temp, "w")) )
+		return;
+
+	ok = fprintf(fp, "%s\n", PLUGIN_CACHE_VERSION) > 0 &&
+		_cache_string(fp, "dir", AO_PLUGIN_PATH) &&
+		fprintf(fp, "dir_mtime %lld\n", (long long)dir_mtime) > 0;
+
+	for (driver = plugins; ok && driver != NULL; driver = driver->next) {
+		if (driver->path == NULL || stat(driver->path, &statbuf)) {
+			ok = 0;
+			break;
+		}
+		info = driver->functions->driver_info();
+
+		ok = _cache_string(fp, "plugin", driver->path) &&
+			fprintf(fp, "stamp %lld %lld\n",
+				(long long)statbuf.st_mtime,
+				(long long)statbuf.st_size) > 0 &&
+			fprintf(fp, "type %d\npriority %d\nbyte_format %d\n",
+				info->type, info->priority,
+				info->preferred_byte_format) > 0 &&
+			_cache_string(fp, "name", info->name) &&
+			_cache_string(fp, "short_name", info->short_name) &&
+			_cache_string(fp, "author", info->author) &&
+			_cache_string(fp, "comment", info->comment);
+		for (i = 0; ok && i < info->option_count; i++)
+			ok = _cache_string(fp, "option", info->options[i]);
+		ok = ok && fprintf(fp, "end\n") > 0;
+	}
+
+	if (fclose(fp) != 0)
+		ok = 0;
+	if (ok && rename(temp, path) == 0) {
+		adebug("Wrote plugin cache %s\n", path);
+	} else
+		unlink(temp);
+}
+
+/* Next line of the cache without its newline, or NULL at the end or
+   on a line too long to be ours */
+static char *_cache_line(FILE *fp, char *line)
+{
+	int end;
+
+	if (!fgets(line, PLUGIN_CACHE_LINE, fp))
+		return NULL;
+	end = strlen(line);
+	if (end == 0 || line[end-1] != '\n')
+		return NULL;
+	line[end-1] = 0;
+
+	return line;
+}
+
+/* The value of "key value", or NULL if line has another key */
+static char *_cache_value(char *line, const char *key)
+{
+	int len = strlen(key);
+
+	if (strncmp(line, key, len) != 0 || line[len] != ' ')
+		return NULL;
+	return line + len + 1;
+}
+
+/* Read one plugin entry, its "plugin" line already in line. NULL if the
+   entry is malformed or the plugin file has changed since. */
+static driver_list *_read_cache_entry(FILE *fp, char *line)
+{
+	driver_list *driver;
+	ao_info *info;
+	struct stat statbuf;
+	long long mtime, size;
+	char **field;
+	char *value;
+	char **options;
+
+	driver = calloc(1, sizeof(driver_list));
+	info = calloc(1, sizeof(ao_info));
+	if (driver == NULL || info == NULL) {
+		free(driver);
+		free(info);
+		return NULL;
+	}
+	driver->info = info;
+
+	if ( !(driver->path = strdup(_cache_value(line, "plugin"))) )
+		goto failed;
+
+	if (!_cache_line(fp, line) ||
+	    sscanf(line, "stamp %lld %lld", &mtime, &size) != 2 ||
+	    stat(driver->path, &statbuf) ||
+	    (long long)statbuf.st_mtime != mtime ||
+	    (long long)statbuf.st_size != size)
+		goto failed;
+
+	if (!_cache_line(fp, line) ||
+	    sscanf(line, "type %d", &info->type) != 1 ||
+	    !_cache_line(fp, line) ||
+	    sscanf(line, "priority %d", &info->priority) != 1 ||
+	    !_cache_line(fp, line) ||
+	    sscanf(line, "byte_format %d", &info->preferred_byte_format) != 1)
+		goto failed;
+
+	while (_cache_line(fp, line)) {
+		if (strcmp(line, "end") == 0) {
+			if (info->short_name == NULL)
+				break;
+			return driver;
+		}
+
+		field = NULL;
+		if ( (value = _cache_value(line, "name")) )
+			field = &info->name;
+		else if ( (value = _cache_value(line, "short_name")) )
+			field = &info->short_name;
+		else if ( (value = _cache_value(line, "author")) )
+			field = &info->author;
+		else if ( (value = _cache_value(line, "comment")) )
+			field = &info->comment;
+		else if ( (value = _cache_value(line, "option")) ) {
+			options = realloc(info->options,
+					  (info->option_count + 1) * sizeof(char *));
+			if (options == NULL)
+				break;
+			info->options = options;
+			field = &info->options[info->option_count++];
+			*field = NULL;
+		} else
+			break;
+
+		free(*field);
+		if ( !(*field = strdup(value)) )
+			break;
+	}
+
+ failed:
+	free(driver->path);
+	_free_info(info);
+	free(driver);
+	return NULL;
+}
+
+/* Append the plugins recorded in the cache to end of the driver list,
+   without loading them. Returns 0, having appended nothing, if there
+   is no cache or it is stale. */
+static int _append_cached_drivers(driver_list *end)
+{
+#ifdef HAVE_DLOPEN
+        ao_device *device = ao_global_dummy;
+	char path[FILENAME_MAX+1];
+	char line[PLUGIN_CACHE_LINE];
+	struct stat statbuf;
+	driver_list *head = NULL;
+	driver_list *driver = NULL;
+	driver_list *plugin;
+	long long dir_mtime;
+	char *value;
+	int ok;
+	FILE *fp;
+
+	if (!_plugin_cache_path(path, sizeof(path)) ||
+	    stat(AO_PLUGIN_PATH, &statbuf))
+		return 0;
+
+	if ( !(fp = fopen(path, "r")) )
+		return 0;
+        adebug("Loading driver plugin list from %s...\n",path);
+
+	ok = _cache_line(fp, line) &&
+		strcmp(line, PLUGIN_CACHE_VERSION) == 0 &&
+		_cache_line(fp, line) &&
+		(value = _cache_value(line, "dir")) &&
+		strcmp(value, AO_PLUGIN_PATH) == 0 &&
+		_cache_line(fp, line) &&
+		sscanf(line, "dir_mtime %lld", &dir_mtime) == 1 &&
+		dir_mtime == (long long)statbuf.st_mtime;
+
+	while (ok && _cache_line(fp, line)) {
+		plugin = NULL;
+		if (_cache_value(line, "plugin"))
+			plugin = _read_cache_entry(fp, line);
+		if (plugin == NULL) {
+			ok = 0;
+			break;
+		}
+
+		if (driver)
+			driver->next = plugin;
+		else
+			head = plugin;
+		driver = plugin;
+	}
+	if (ok && !feof(fp))
+		ok = 0;
+	fclose(fp);
+
+	if (!ok) {
+		adebug("Plugin cache is stale, scanning %s\n",AO_PLUGIN_PATH);
+		while (head) {
+			plugin = head->next;
+			free(head->path);
+			_free_info(head->info);
+			free(head);
+			head = plugin;
+		}
+		return 0;
+	}
+
+	for (plugin = head; plugin != NULL; plugin = plugin->next)
+		adebug("Found driver %s (not loaded yet)\n",plugin->info->short_name);
+	end->next = head;
+
+	return 1;
+#else
+	return 0;
+#endif
+}
+
+
 /* If *name is a valid driver name, return its driver number.
    Otherwise, test all of available live drivers until one works. */
 static int _find_default_driver_id (const char *name)
@@ -223,10 +596,11 @@ static int _find_default_driver_id (const char *name)
 		id = 0;
 		while (dl != NULL) {
 
-			info = dl->functions->driver_info();
+			info = _driver_info(dl);
                         adebug("...testing %s\n",info->short_name);
 			if ( info->type == AO_TYPE_LIVE &&
 			     info->priority > 0 && /* Skip static drivers */
+			     _load_driver(dl) &&
 			     dl->functions->test() ) {
 				def_id = id; /* Found a usable driver */
                                 adebug("OK, using driver %s\n",info->short_name);
@@ -293,6 +667,12 @@ static void _append_dynamic_drivers(driver_list *end)
 	driver_list *plugin;
 	driver_list *driver = end;
         ao_device *device = ao_global_dummy;
+	time_t dir_mtime = 0;
+
+	/* Stamped before the scan, so that plugins changing under it
+	   leave the cache stale */
+	if (!stat(AO_PLUGIN_PATH, &statbuf))
+		dir_mtime = statbuf.st_mtime;
 
 	/* now insert any plugins we find */
 	plugindir = opendir(AO_PLUGIN_PATH);
@@ -308,6 +688,7 @@ static void _append_dynamic_drivers(driver_list *end)
               if (strcmp(ext, SHARED_LIB_EXT) == 0) {
                 plugin = _get_plugin(fullpath);
                 if (plugin) {
+                  plugin->path = strdup(fullpath);
                   driver->next = plugin;
                   plugin->next = NULL;
                   driver = driver->next;
@@ -317,6 +698,7 @@ static void _append_dynamic_drivers(driver_list *end)
           }
 
           closedir(plugindir);
+          _write_plugin_cache(end->next, dir_mtime);
 	}
 #endif
 }
@@ -327,8 +709,8 @@ static void _append_dynamic_drivers(driver_list *end)
 static int _compar_driver_priority (const driver_list **a,
 				    const driver_list **b)
 {
-	return memcmp(&((*b)->functions->driver_info()->priority),
-		      &((*a)->functions->driver_info()->priority),
+	return memcmp(&(_driver_info(*b)->priority),
+		      &(_driver_info(*a)->priority),
 		      sizeof(int));
 }
 
@@ -373,7 +755,7 @@ static ao_info ** _make_info_table (driver_list **head, int *driver_count)
 	table = (ao_info **) calloc(i, sizeof(ao_info *));
 	if (table != NULL) {
 		for (i = 0; i < *driver_count; i++)
-			table[i] = drivers_table[i]->functions->driver_info();
+			table[i] = _driver_info(drivers_table[i]);
 	}
 
 	free(drivers_table);
@@ -460,6 +842,7 @@ static ao_device* _create_device(int driver_id, driver_list *driver,
                 device->output_channels = format->channels;
                 device->inter_permute = NULL;
                 device->output_matrix = NULL;
+                device->resample_quality = 1;
 	}
 
 	return device;
@@ -485,122 +868,512 @@ static int _realloc_swap_buffer(ao_device *device, int min_size)
 }
 
 
-static void _buffer_zero(char *target,int och,int bytewidth,int ochannels,int bytes){
-  int i = och*bytewidth;
-  int stride = bytewidth*ochannels;
-  switch(bytewidth){
-  case 1:
-    while(i<bytes){
-      ((unsigned char *)target)[i] = 128; /* 8 bit PCM is unsigned in libao */
-      i+=stride;
-    }
-    break;
-  case 2:
-    while(i<bytes){
-      target[i] = 0;
-      target[i+1] = 0;
-      i+=stride;
-    }
-    break;
-  case 3:
-    while(i<bytes){
-      target[i] = 0;
-      target[i+1] = 0;
-      target[i+2] = 0;
-      i+=stride;
-    }
-    break;
-  case 4:
-    while(i<bytes){
-      target[i] = 0;
-      target[i+1] = 0;
-      target[i+2] = 0;
-      target[i+3] = 0;
-      i+=stride;
-    }
-    break;
-  }
+/* ---------- Sample conversion for ao_play() ---------- */
+
+/* Each kernel converts whole frames from the client's buffer into the
+   swap buffer. ao_open picks one for the device's format, so ao_play
+   doesn't have to look at the format again. */
+
+typedef void (*ao_convert_func)(ao_device *device,char *target,const char *source,int frames);
+
+static int _needs_swap(ao_device *device){
+  return device->bytewidth>1 &&
+    device->client_byte_format != device->driver_byte_format;
 }
 
-static void _buffer_permute_swap(char *target,int och,int bytewidth,int ochannels,int bytes,
-                                 char *source,int ich, int ichannels){
-  int o = och*bytewidth;
-  int i = ich*bytewidth;
+/* One pass per output channel, striding through the frames: the channel
+   is zeroed, copied or byte swapped from its input channel. The wrappers
+   below call it with constant widths and channel counts so the compiler
+   can unroll the inner loops. */
+static inline void _convert_channels(char *target,const char *source,int frames,
+                                     int bytewidth,int ichannels,int ochannels,
+                                     const int *permute,int swap){
   int ostride = bytewidth*ochannels;
   int istride = bytewidth*ichannels;
-  switch(bytewidth){
-  case 2:
-    while(o<bytes){
-      target[o] = source[i+1];
-      target[o+1] = source[i];
-      o+=ostride;
-      i+=istride;
+  int f,o,b;
+  for(o=0;o<ochannels;o++){
+    int ic = permute ? permute[o] : o;
+    char *t = target + o*bytewidth;
+    const char *s = source + ic*bytewidth;
+    if(ic==-1){
+      for(f=0;f<frames;f++,t+=ostride)
+        for(b=0;b<bytewidth;b++)
+          /* 8 bit PCM is unsigned in libao */
+          t[b] = bytewidth==1 ? (char)128 : 0;
+    }else if(swap){
+      for(f=0;f<frames;f++,t+=ostride,s+=istride)
+        for(b=0;b<bytewidth;b++)
+          t[b] = s[bytewidth-1-b];
+    }else{
+      for(f=0;f<frames;f++,t+=ostride,s+=istride)
+        for(b=0;b<bytewidth;b++)
+          t[b] = s[b];
     }
-    break;
-  case 3:
-    while(o<bytes){
-      target[o] = source[i+2];
-      target[o+1] = source[i+1];
-      target[o+2] = source[i];
-      o+=ostride;
-      i+=istride;
+  }
+}
+
+/* Any format */
+static void _convert_any(ao_device *device,char *target,const char *source,int frames){
+  _convert_channels(target,source,frames,device->bytewidth,device->input_channels,
+                    device->output_channels,device->inter_permute,_needs_swap(device));
+}
+
+/* Permutation of stereo or 5.1, same channel count in and out */
+#define CONVERT_FIXED(name,bytewidth,channels)                          \
+  static void name(ao_device *device,char *target,const char *source,int frames){ \
+    if(_needs_swap(device))                                             \
+      _convert_channels(target,source,frames,bytewidth,channels,channels,device->inter_permute,1); \
+    else                                                                \
+      _convert_channels(target,source,frames,bytewidth,channels,channels,device->inter_permute,0); \
+  }
+
+CONVERT_FIXED(_convert_16_2,2,2)
+CONVERT_FIXED(_convert_16_6,2,6)
+CONVERT_FIXED(_convert_24_2,3,2)
+CONVERT_FIXED(_convert_24_6,3,6)
+
+#if defined(__SSSE3__)
+/* Permutation and byte swap in one byte shuffle, for frames that fit a
+   16 byte register (16 bit stereo and 5.1, 24 bit stereo). Each step
+   does as many whole frames as fit and stores all 16 bytes; the junk
+   past the last frame is overwritten by the next step. The scalar kernel
+   finishes the frames too close to the end of the buffer. */
+static void _shuffle_frames(ao_device *device,char *target,const char *source,int frames,
+                            ao_convert_func tail){
+  int bytewidth = device->bytewidth;
+  int channels = device->output_channels;
+  int framebytes = bytewidth*channels;
+  int per = 16/framebytes;
+  int swap = _needs_swap(device);
+  signed char mask[16];
+  __m128i shuffle;
+  int i,f = 0;
+
+  for(i=0;i<16;i++){
+    int frame = i/framebytes, o = i%framebytes/bytewidth, b = i%bytewidth;
+    int ic = device->inter_permute[o];
+    if(frame>=per)
+      mask[i] = i;
+    else if(ic==-1)
+      mask[i] = -128; /* high bit set: pshufb writes a zero */
+    else
+      mask[i] = frame*framebytes + ic*bytewidth + (swap ? bytewidth-1-b : b);
+  }
+  shuffle = _mm_loadu_si128((const __m128i *)mask);
+
+  for(;f*framebytes+16<=frames*framebytes;f+=per){
+    __m128i x = _mm_loadu_si128((const __m128i *)(source+f*framebytes));
+    _mm_storeu_si128((__m128i *)(target+f*framebytes),_mm_shuffle_epi8(x,shuffle));
+  }
+  tail(device,target+f*framebytes,source+f*framebytes,frames-f);
+}
+
+static void _shuffle_16_2(ao_device *device,char *target,const char *source,int frames){
+  _shuffle_frames(device,target,source,frames,_convert_16_2);
+}
+
+static void _shuffle_16_6(ao_device *device,char *target,const char *source,int frames){
+  _shuffle_frames(device,target,source,frames,_convert_16_6);
+}
+
+static void _shuffle_24_2(ao_device *device,char *target,const char *source,int frames){
+  _shuffle_frames(device,target,source,frames,_convert_24_2);
+}
+#endif
+
+/* Byte swap only. The channels stay in place, so every sample is treated
+   alike whatever the channel count */
+static void _swap_16(ao_device *device,char *target,const char *source,int frames){
+  int n = frames*device->output_channels;
+  int i = 0;
+#if defined(__SSE2__)
+  for(;i+8<=n;i+=8){
+    __m128i x = _mm_loadu_si128((const __m128i *)(source+i*2));
+    _mm_storeu_si128((__m128i *)(target+i*2),
+                     _mm_or_si128(_mm_slli_epi16(x,8),_mm_srli_epi16(x,8)));
+  }
+#endif
+  _convert_channels(target+i*2,source+i*2,n-i,2,1,1,NULL,1);
+}
+
+static void _swap_24(ao_device *device,char *target,const char *source,int frames){
+  int n = frames*device->output_channels;
+  int i = 0;
+#if defined(__SSSE3__)
+  /* Five samples per 16 byte register. The 16th byte stored is junk,
+     but the next step (or the scalar tail) overwrites it */
+  const __m128i reverse = _mm_setr_epi8(2,1,0,5,4,3,8,7,6,11,10,9,14,13,12,15);
+  for(;i+6<=n;i+=5){
+    __m128i x = _mm_loadu_si128((const __m128i *)(source+i*3));
+    _mm_storeu_si128((__m128i *)(target+i*3),_mm_shuffle_epi8(x,reverse));
+  }
+#endif
+  _convert_channels(target+i*3,source+i*3,n-i,3,1,1,NULL,1);
+}
+
+static void _swap_32(ao_device *device,char *target,const char *source,int frames){
+  int n = frames*device->output_channels;
+  int i = 0;
+#if defined(__SSE2__)
+  for(;i+4<=n;i+=4){
+    __m128i x = _mm_loadu_si128((const __m128i *)(source+i*4));
+    x = _mm_or_si128(_mm_slli_epi32(x,16),_mm_srli_epi32(x,16));
+    _mm_storeu_si128((__m128i *)(target+i*4),
+                     _mm_or_si128(_mm_slli_epi16(x,8),_mm_srli_epi16(x,8)));
+  }
+#endif
+  _convert_channels(target+i*4,source+i*4,n-i,4,1,1,NULL,1);
+}
+
+/* 16 bit stereo with left and right exchanged: rotating each 32 bit
+   frame by 16 bits, plus the byte swap if needed */
+static void _exchange_16_2(ao_device *device,char *target,const char *source,int frames){
+  int swap = _needs_swap(device);
+  int i = 0;
+#if defined(__SSE2__)
+  for(;i+4<=frames;i+=4){
+    __m128i x = _mm_loadu_si128((const __m128i *)(source+i*4));
+    x = _mm_or_si128(_mm_slli_epi32(x,16),_mm_srli_epi32(x,16));
+    if(swap)
+      x = _mm_or_si128(_mm_slli_epi16(x,8),_mm_srli_epi16(x,8));
+    _mm_storeu_si128((__m128i *)(target+i*4),x);
+  }
+#endif
+  _convert_16_2(device,target+i*4,source+i*4,frames-i);
+}
+
+/* Choose the kernel for an open device. NULL means there is nothing to
+   convert: the device has no swap buffer and ao_play hands the client's
+   buffer straight to the driver. */
+static ao_convert_func _choose_convert(ao_device *device){
+  int *p = device->inter_permute;
+  int channels = device->output_channels;
+
+  if(!device->swap_buffer)
+    return NULL;
+  if(channels != device->input_channels)
+    return _convert_any;
+
+  if(!p){
+    /* No permutation, so the buffer exists for the byte swap */
+    switch(device->bytewidth){
+    case 2: return _swap_16;
+    case 3: return _swap_24;
+    case 4: return _swap_32;
     }
-    break;
-  case 4:
-    while(o<bytes){
-      target[o] = source[i+3];
-      target[o+1] = source[i+2];
-      target[o+2] = source[i+1];
-      target[o+3] = source[i];
-      o+=ostride;
-      i+=istride;
+    return _convert_any;
+  }
+
+  if(device->bytewidth==2 && channels==2 && p[0]==1 && p[1]==0)
+    return _exchange_16_2;
+#if defined(__SSSE3__)
+  if(device->bytewidth==2 && channels==2) return _shuffle_16_2;
+  if(device->bytewidth==2 && channels==6) return _shuffle_16_6;
+  if(device->bytewidth==3 && channels==2) return _shuffle_24_2;
+#else
+  if(device->bytewidth==2 && channels==2) return _convert_16_2;
+  if(device->bytewidth==2 && channels==6) return _convert_16_6;
+  if(device->bytewidth==3 && channels==2) return _convert_24_2;
+#endif
+  if(device->bytewidth==3 && channels==6) return _convert_24_6;
+  return _convert_any;
+}
+
+
+/* ---------- Sample rate conversion ---------- */
+
+/* When a driver runs at another rate than the client asked for, ao_play
+   resamples with a windowed sinc. The output rate over the input rate
+   reduces to up/down; output frame n sits at input time n*down/up, so
+   only up distinct filter phases exist and each is tabulated once. Rates
+   with more phases than RESAMPLE_MAX_PHASES interpolate between the two
+   nearest of that many instead. The filter works on planar floats in the
+   driver's own sample format, after the channel conversion above. */
+
+struct ao_resampler {
+  int    channels;
+  int    bytewidth;
+  int    big_endian;
+  int    taps;             /* per phase, a multiple of 8 */
+  int    phases;           /* table rows - 1; row r is offset r/phases */
+  int    up,down;          /* output and input rate over their gcd */
+  int    phase;            /* of the next output frame, in 1/up input frames */
+  float *table;
+
+  float *history;          /* channel c at history + c*capacity */
+  int    capacity;         /* frames per channel */
+  int    filled;           /* frames held, the oldest taps-1 already used */
+
+  float *result;           /* interleaved output, before _store_all */
+  char  *out;
+  int    out_frames;       /* room in both */
+};
+
+static const struct {
+  const char *name;
+  int taps;
+  double beta;             /* Kaiser window shape */
+  double passband;         /* cutoff, as a share of the lower Nyquist rate */
+} resample_qualities[] = {
+  { "fast",    8, 5.0, 0.80 },
+  { "medium", 24, 7.0, 0.90 },
+  { "best",   64, 9.0, 0.95 },
+};
+
+#define RESAMPLE_MAX_PHASES 1024
+
+static int _gcd(int a, int b){
+  while(b){
+    int t = a%b;
+    a = b;
+    b = t;
+  }
+  return a;
+}
+
+/* Zeroth order modified Bessel function, for the Kaiser window */
+static double _bessel_i0(double x){
+  double sum = 1, term = 1;
+  int k;
+  for(k=1;k<50 && term>sum*1e-12;k++){
+    term *= (x/(2*k))*(x/(2*k));
+    sum += term;
+  }
+  return sum;
+}
+
+static void _free_resampler(ao_resampler *r){
+  free(r->table);
+  free(r->history);
+  free(r->result);
+  free(r->out);
+  free(r);
+}
+
+static ao_resampler *_create_resampler(ao_device *device, int quality){
+  ao_resampler *r = calloc(1,sizeof(*r));
+  int g = _gcd(device->rate,device->output_rate);
+  double cutoff,beta;
+  int row,k;
+
+  if(r == NULL)
+    return NULL;
+  r->channels = device->output_channels;
+  r->bytewidth = device->bytewidth;
+  r->big_endian = device->driver_byte_format == AO_FMT_BIG;
+  r->taps = resample_qualities[quality].taps;
+  r->up = device->output_rate/g;
+  r->down = device->rate/g;
+  r->phases = r->up < RESAMPLE_MAX_PHASES ? r->up : RESAMPLE_MAX_PHASES;
+
+  /* Cut off below the lower of the two Nyquist rates, in cycles per
+     input frame */
+  cutoff = 0.5*resample_qualities[quality].passband;
+  if(r->up < r->down)
+    cutoff = cutoff*r->up/r->down;
+  beta = resample_qualities[quality].beta;
+
+  r->table = malloc(sizeof(*r->table)*r->taps*(r->phases+1));
+  r->capacity = r->taps*2;
+  r->history = calloc(r->capacity*r->channels,sizeof(*r->history));
+  if(r->table == NULL || r->history == NULL){
+    _free_resampler(r);
+    return NULL;
+  }
+
+  for(row=0;row<=r->phases;row++){
+    float *h = r->table + row*r->taps;
+    double sum = 0;
+    for(k=0;k<r->taps;k++){
+      /* Distance from the output time, in input frames */
+      double t = k - (r->taps/2-1) - (double)row/r->phases;
+      double w = t/(r->taps/2);
+      double x = 2*M_PI*cutoff*t;
+      double v = w<-1 || w>1 ? 0 : _bessel_i0(beta*sqrt(1-w*w))/_bessel_i0(beta);
+      v *= fabs(x)<1e-9 ? 1 : sin(x)/x;
+      h[k] = v;
+      sum += v;
     }
-    break;
+    /* Unity gain at DC for every phase */
+    for(k=0;k<r->taps;k++)
+      h[k] /= sum;
   }
+
+  /* Half a filter of silence ahead of the first frame, so output frame
+     0 is centred on input frame 0 */
+  r->filled = r->taps/2-1;
+  return r;
 }
 
-static void _buffer_permute(char *target,int och,int bytewidth,int ochannels,int bytes,
-                            char *source,int ich, int ichannels){
-  int o = och*bytewidth;
-  int i = ich*bytewidth;
-  int ostride = bytewidth*ochannels;
-  int istride = bytewidth*ichannels;
-  switch(bytewidth){
-  case 1:
-    while(o<bytes){
-      target[o] = source[i];
-      o+=ostride;
-      i+=istride;
+static inline float _dot(const float *x, const float *h, int taps){
+  int k;
+#if defined(__SSE2__)
+  /* Two accumulators to hide the add latency */
+  __m128 a = _mm_setzero_ps(), b = _mm_setzero_ps();
+  for(k=0;k<taps;k+=8){
+    a = _mm_add_ps(a,_mm_mul_ps(_mm_loadu_ps(x+k),_mm_loadu_ps(h+k)));
+    b = _mm_add_ps(b,_mm_mul_ps(_mm_loadu_ps(x+k+4),_mm_loadu_ps(h+k+4)));
+  }
+  a = _mm_add_ps(a,b);
+  a = _mm_add_ps(a,_mm_movehl_ps(a,a));
+  a = _mm_add_ss(a,_mm_shuffle_ps(a,a,1));
+  return _mm_cvtss_f32(a);
+#else
+  float sum = 0;
+  for(k=0;k<taps;k++)
+    sum += x[k]*h[k];
+  return sum;
+#endif
+}
+
+/* Samples of the driver's format to floats in [-1,1) and back, rounding
+   and clipping. Like _convert_channels, these are only called with a
+   constant width so the byte loops unroll. */
+static inline void _load_samples(float *target,const unsigned char *source,int count,
+                                 int stride,int bytewidth,int big_endian){
+  int i,b;
+  for(i=0;i<count;i++,source+=stride){
+    sint_32 v = 0;
+    if(bytewidth==1){
+      target[i] = (source[0]-128)*(1.f/128);
+      continue;
     }
-    break;
-  case 2:
-    while(o<bytes){
-      target[o] = source[i];
-      target[o+1] = source[i+1];
-      o+=ostride;
-      i+=istride;
+    for(b=0;b<bytewidth;b++)
+      v |= (sint_32)((uint_32)source[big_endian ? b : bytewidth-1-b] << (24-8*b));
+    target[i] = v*(1.f/2147483648.f);
+  }
+}
+
+static inline void _store_samples(unsigned char *target,const float *source,int count,
+                                  int bytewidth,int big_endian){
+  const float scale = bytewidth==4 ? 2147483648.f : (float)(1<<(bytewidth*8-1));
+  int i,b;
+  for(i=0;i<count;i++,target+=bytewidth){
+    /* Clipped in double, where 2^31-1 is exact */
+    double s = (double)source[i]*scale;
+    sint_32 v;
+    if(s > scale-1) s = scale-1;
+    if(s < -scale) s = -scale;
+    v = (sint_32)lrint(s);
+    if(bytewidth==1){
+      target[0] = (unsigned char)(v+128);
+      continue;
     }
-    break;
-  case 3:
-    while(o<bytes){
-      target[o] = source[i];
-      target[o+1] = source[i+1];
-      target[o+2] = source[i+2];
-      o+=ostride;
-      i+=istride;
+    for(b=0;b<bytewidth;b++)
+      target[big_endian ? bytewidth-1-b : b] = (unsigned char)(v >> (8*b));
+  }
+}
+
+static void _load_channel(ao_resampler *r,float *target,const char *source,int frames){
+  const unsigned char *s = (const unsigned char *)source;
+  int stride = r->bytewidth*r->channels;
+  switch(r->bytewidth){
+  case 1: _load_samples(target,s,frames,stride,1,0); break;
+  case 2: _load_samples(target,s,frames,stride,2,r->big_endian); break;
+  case 3: _load_samples(target,s,frames,stride,3,r->big_endian); break;
+  default: _load_samples(target,s,frames,stride,4,r->big_endian); break;
+  }
+}
+
+static void _store_all(ao_resampler *r,char *target,const float *source,int count){
+  unsigned char *t = (unsigned char *)target;
+  int i = 0;
+  switch(r->bytewidth){
+  case 1: _store_samples(t,source,count,1,0); break;
+  case 2:
+#if defined(__SSE2__)
+    /* x86 is little endian. packs saturates, so no clamp is needed */
+    if(!r->big_endian){
+      const __m128 scale = _mm_set1_ps(32768.f);
+      for(;i+8<=count;i+=8){
+        __m128i a = _mm_cvtps_epi32(_mm_mul_ps(_mm_loadu_ps(source+i),scale));
+        __m128i b = _mm_cvtps_epi32(_mm_mul_ps(_mm_loadu_ps(source+i+4),scale));
+        _mm_storeu_si128((__m128i *)(t+i*2),_mm_packs_epi32(a,b));
+      }
     }
+#endif
+    _store_samples(t+i*2,source+i,count-i,2,r->big_endian);
     break;
-  case 4:
-    while(o<bytes){
-      target[o] = source[i];
-      target[o+1] = source[i+1];
-      target[o+2] = source[i+2];
-      target[o+3] = source[i+3];
-      o+=ostride;
-      i+=istride;
+  case 3: _store_samples(t,source,count,3,r->big_endian); break;
+  default: _store_samples(t,source,count,4,r->big_endian); break;
+  }
+}
+
+/* Feed num_bytes of whole frames in the driver's format, and point
+   *out at the frames that are now ready (possibly none) */
+static int _resample(ao_resampler *r, const char *source, uint_32 num_bytes,
+                     char **out, uint_32 *out_bytes){
+  int frame_bytes = r->bytewidth*r->channels;
+  int frames = num_bytes/frame_bytes;
+  int c,pos,produced,max_out;
+
+  /* Room for the new frames behind the history */
+  if(r->filled+frames > r->capacity){
+    int capacity = r->capacity;
+    float *history;
+    while(capacity < r->filled+frames)
+      capacity *= 2;
+    history = malloc(sizeof(*history)*capacity*r->channels);
+    if(history == NULL)
+      return 0;
+    for(c=0;c<r->channels;c++)
+      memcpy(history+c*capacity,r->history+c*r->capacity,sizeof(*history)*r->filled);
+    free(r->history);
+    r->history = history;
+    r->capacity = capacity;
+  }
+  for(c=0;c<r->channels;c++)
+    _load_channel(r,r->history+c*r->capacity+r->filled,source+c*r->bytewidth,frames);
+  r->filled += frames;
+
+  /* Room for what this call can produce, as floats and as samples */
+  max_out = (int)((double)frames*r->up/r->down) + 2;
+  if(max_out > r->out_frames){
+    float *result = realloc(r->result,sizeof(*result)*max_out*r->channels);
+    char *out = result ? realloc(r->out,max_out*frame_bytes) : NULL;
+    if(result) r->result = result;
+    if(out == NULL)
+      return 0;
+    r->out = out;
+    r->out_frames = max_out;
+  }
+
+  /* Every output frame whose window is complete */
+  pos = 0;
+  produced = 0;
+  while(pos+r->taps <= r->filled){
+    float *t = r->result + produced*r->channels;
+    if(r->phases == r->up){
+      const float *h = r->table + r->taps*r->phase;
+      for(c=0;c<r->channels;c++)
+        t[c] = _dot(r->history+c*r->capacity+pos,h,r->taps);
+    }else{
+      double at = (double)r->phase*r->phases/r->up;
+      int row = (int)at;
+      float a = at-row;
+      const float *h = r->table + r->taps*row;
+      for(c=0;c<r->channels;c++){
+        const float *x = r->history+c*r->capacity+pos;
+        t[c] = (1-a)*_dot(x,h,r->taps) + a*_dot(x,h+r->taps,r->taps);
+      }
     }
-    break;
+    produced++;
+    r->phase += r->down;
+    pos += r->phase/r->up;
+    r->phase %= r->up;
+  }
+
+  /* Keep what later windows still need */
+  for(c=0;c<r->channels;c++){
+    float *h = r->history + c*r->capacity;
+    memmove(h,h+pos,sizeof(*h)*(r->filled-pos));
   }
+  r->filled -= pos;
+
+  _store_all(r,r->out,r->result,produced*r->channels);
+  *out = r->out;
+  *out_bytes = produced*frame_bytes;
+  return 1;
 }
 
 
@@ -921,6 +1694,18 @@ static int ao_device_load_options(ao_device *device, ao_option *options){
       if(device->verbose<1)device->verbose=1;
     }else if(!strcmp(options->key,"quiet")){
       device->verbose=-1;
+    }else if(!strcmp(options->key,"resample")){
+      int q;
+      device->resample_quality = -2;
+      if(!strcmp(options->value,"off"))
+        device->resample_quality = -1;
+      for(q=0;q<(int)(sizeof(resample_qualities)/sizeof(*resample_qualities));q++)
+        if(!strcmp(options->value,resample_qualities[q].name))
+          device->resample_quality = q;
+      if(device->resample_quality == -2){
+        aerror("Unknown resample quality %s\n",options->value);
+        return AO_EBADOPTION;
+      }
     }else{
       if (!device->funcs->set_option(device, options->key, options->value)) {
         /* Problem setting options */
@@ -953,6 +1738,12 @@ static ao_device* _open_device(int driver_id, ao_sample_format *format,
 		goto error;
 	}
 
+	/* Cached plugins are only loaded now */
+	if (!_load_driver(driver)) {
+		errno = AO_ENODRIVER;
+		goto error;
+	}
+
 	funcs = driver->functions;
 
 	/* Check the driver type */
@@ -1086,6 +1877,7 @@ static ao_device* _open_device(int driver_id, ao_sample_format *format,
         device->input_channels = sformat.channels;
         device->bytewidth = (sformat.bits+7)>>3;
         device->rate = sformat.rate;
+        device->output_rate = sformat.rate;
 
 	/* Open the device */
 	result = funcs->open(device, &sformat);
@@ -1213,6 +2005,32 @@ static ao_device* _open_device(int driver_id, ao_sample_format *format,
             return NULL; /* Couldn't alloc swap buffer */
           }
 	}
+        device->convert = _choose_convert(device);
+
+        /* The driver settled on another rate */
+        if(device->output_rate != device->rate){
+          if(device->resample_quality < 0){
+            awarn("sample rate %i not supported, using %i without resampling\n",
+                  device->rate, device->output_rate);
+          }else{
+            averbose("resampling %i Hz to %i Hz (%s)\n", device->rate, device->output_rate,
+                     resample_qualities[device->resample_quality].name);
+            device->resampler = _create_resampler(device,device->resample_quality);
+            if(device->resampler == NULL){
+              if(sformat.matrix)free(sformat.matrix);
+              device->funcs->close(device);
+              device->funcs->device_clear(device);
+              free(device->swap_buffer);
+              free(device->output_matrix);
+              free(device->input_map);
+              free(device->inter_matrix);
+              free(device->inter_permute);
+              free(device);
+              errno = AO_EFAIL;
+              return NULL;
+            }
+          }
+        }
 
 	/* If we made it this far, everything is OK. */
         if(sformat.matrix)free(sformat.matrix);
@@ -1230,6 +2048,213 @@ static ao_device* _open_device(int driver_id, ao_sample_format *format,
 }
 
 
+/* Convert if needed and hand the samples to the driver. The caller's
+   thread for plain ao_play, the writer thread in async mode */
+static int _play_now(ao_device *device, char* output_samples, uint_32 num_bytes)
+{
+	char *playback_buffer;
+
+	if (device->convert != NULL) {
+          int frames = num_bytes/(device->bytewidth*device->input_channels);
+          int out_bytes = frames*device->bytewidth*device->output_channels;
+          if (_realloc_swap_buffer(device, out_bytes)) {
+            device->convert(device, device->swap_buffer, output_samples, frames);
+            playback_buffer = device->swap_buffer;
+            num_bytes = out_bytes;
+          } else
+            return 0; /* Could not expand swap buffer */
+	} else
+          playback_buffer = output_samples;
+
+	if (device->resampler != NULL) {
+          if (!_resample(device->resampler, playback_buffer, num_bytes,
+                         &playback_buffer, &num_bytes))
+            return 0; /* Could not expand the resampler's buffers */
+          if (num_bytes == 0)
+            return 1;
+	}
+
+	return device->funcs->play(device, playback_buffer, num_bytes);
+}
+
+/* Push half a filter of silence through the resampler, so the last
+   frames the client played come out too */
+static int _resample_flush(ao_device *device)
+{
+	ao_resampler *r = device->resampler;
+	uint_32 bytes = (r->taps/2)*r->bytewidth*r->channels;
+	char *silence = malloc(bytes);
+	char *out;
+	uint_32 out_bytes;
+	int result = 0;
+
+	if (silence == NULL)
+	  return 0;
+	memset(silence, r->bytewidth==1 ? 128 : 0, bytes);
+	if (_resample(r, silence, bytes, &out, &out_bytes))
+	  result = out_bytes == 0 || device->funcs->play(device, out, out_bytes);
+	free(silence);
+	return result;
+}
+
+
+/* ---------- Asynchronous playback ---------- */
+
+#ifdef HAVE_LIBPTHREAD
+
+/* A ring of whole input frames between the client and a writer thread
+   that owns the driver. The lock only covers the counters: the client
+   copies into free space and the writer plays straight out of the queued
+   space without holding it, so neither ever waits on the other's I/O. */
+struct ao_async {
+  pthread_t thread;
+  pthread_mutex_t mutex;
+  pthread_cond_t queued_cond;   /* writer: data arrived or stopping */
+  pthread_cond_t space_cond;    /* blocking ao_play: space freed */
+
+  char    *ring;
+  uint_32  size;                /* bytes, a multiple of the frame size */
+  uint_32  head;                /* where the client writes next */
+  uint_32  queued;              /* bytes before head not yet played */
+  uint_32  chunk;               /* most bytes the writer plays at once */
+  uint_32  frame_bytes;
+  uint_32  bytes_per_sec;
+
+  uint_32  underruns;
+  int      playing;             /* played since the ring last ran dry */
+  int      pending;             /* the client had more than the ring took */
+  int      failed;              /* the driver's play failed */
+  int      stop;
+};
+
+static void *_async_writer(void *arg)
+{
+  ao_device *device = arg;
+  ao_async *a = device->async;
+
+  pthread_mutex_lock(&a->mutex);
+  for(;;){
+    uint_32 tail,bytes;
+    int ok;
+
+    while(a->queued==0 && !a->stop){
+      /* running dry only counts while the client is still behind; the
+         end of the stream or a pause between writes is not an underrun */
+      if(a->playing && a->pending)
+        a->underruns++;
+      a->playing=0;
+      pthread_cond_wait(&a->queued_cond,&a->mutex);
+    }
+    if(a->queued==0 || a->failed)break; /* stopping, and drained */
+
+    /* up to the end of the ring; whole frames, since size and every
+       write are */
+    tail = (a->head + a->size - a->queued) % a->size;
+    bytes = a->queued;
+    if(bytes > a->size - tail) bytes = a->size - tail;
+    if(bytes > a->chunk) bytes = a->chunk;
+    pthread_mutex_unlock(&a->mutex);
+
+    ok = _play_now(device, a->ring + tail, bytes);
+
+    pthread_mutex_lock(&a->mutex);
+    a->queued -= bytes;
+    a->playing = 1;
+    if(!ok)a->failed = 1;
+    pthread_cond_signal(&a->space_cond);
+  }
+  a->failed = 1; /* nothing plays from here on */
+  pthread_cond_signal(&a->space_cond);
+  pthread_mutex_unlock(&a->mutex);
+  return NULL;
+}
+
+/* Copy as many whole frames as fit, never waiting. Only the client
+   writes to the free space, so the copy runs outside the lock */
+static int _async_write(ao_async *a, const char *samples, uint_32 num_bytes)
+{
+  uint_32 head,space,first;
+
+  pthread_mutex_lock(&a->mutex);
+  if(a->failed){
+    pthread_mutex_unlock(&a->mutex);
+    return -1;
+  }
+  head = a->head;
+  space = a->size - a->queued;
+  space -= space % a->frame_bytes;
+  a->pending = num_bytes > space;
+  pthread_mutex_unlock(&a->mutex);
+
+  if(num_bytes > space) num_bytes = space;
+  num_bytes -= num_bytes % a->frame_bytes;
+  if(num_bytes==0) return 0;
+
+  first = a->size - head;
+  if(first > num_bytes) first = num_bytes;
+  memcpy(a->ring + head, samples, first);
+  memcpy(a->ring, samples + first, num_bytes - first);
+
+  pthread_mutex_lock(&a->mutex);
+  a->head = (head + num_bytes) % a->size;
+  a->queued += num_bytes;
+  pthread_cond_signal(&a->queued_cond);
+  pthread_mutex_unlock(&a->mutex);
+  return num_bytes;
+}
+
+/* ao_play on an async device: queue everything, waiting for space */
+static int _async_play_blocking(ao_async *a, const char *samples, uint_32 num_bytes)
+{
+  num_bytes -= num_bytes % a->frame_bytes;
+  while(num_bytes>0){
+    int n = _async_write(a, samples, num_bytes);
+    if(n<0) return 0;
+    samples += n;
+    num_bytes -= n;
+    if(num_bytes>0){
+      pthread_mutex_lock(&a->mutex);
+      while(a->size - a->queued < a->frame_bytes && !a->failed)
+        pthread_cond_wait(&a->space_cond,&a->mutex);
+      pthread_mutex_unlock(&a->mutex);
+    }
+  }
+  return 1;
+}
+
+/* Let the writer drain what is queued, then stop it */
+static void _async_stop(ao_device *device)
+{
+  ao_async *a = device->async;
+
+  pthread_mutex_lock(&a->mutex);
+  a->stop = 1;
+  pthread_cond_signal(&a->queued_cond);
+  pthread_mutex_unlock(&a->mutex);
+  pthread_join(a->thread,NULL);
+
+  pthread_cond_destroy(&a->space_cond);
+  pthread_cond_destroy(&a->queued_cond);
+  pthread_mutex_destroy(&a->mutex);
+  free(a->ring);
+  free(a);
+  device->async = NULL;
+}
+
+#else /* no threads: async mode is unavailable */
+
+static int _async_play_blocking(ao_async *a, const char *samples, uint_32 num_bytes)
+{
+  return 0;
+}
+
+static void _async_stop(ao_device *device)
+{
+}
+
+#endif
+
+
 /* ---------- Public Functions ---------- */
 
 /* -- Library Setup/Teardown -- */
@@ -1254,7 +2279,8 @@ void ao_initialize(void)
 
 	if (driver_head == NULL) {
 		driver_head = _load_static_drivers(&end);
-		_append_dynamic_drivers(end);
+		if (!_append_cached_drivers(end))
+			_append_dynamic_drivers(end);
 	}
 
 	/* Create the table of driver info structs */
@@ -1278,6 +2304,8 @@ void ao_shutdown(void)
 		  dlclose(driver->handle);
 		  free(driver->functions); /* DON'T FREE STATIC FUNC TABLES */
 		}
+		free(driver->path);
+		_free_info(driver->info);
 		next_driver = driver->next;
 		free(driver);
 		driver = next_driver;
@@ -1360,7 +2388,8 @@ ao_device *ao_open_file (int driver_id, const char *filename, int overwrite,
 		}
 
 
-		file = fopen(filename, "w");
+		/* Readable too, so the file drivers can map it */
+		file = fopen(filename, "w+");
 	}
 
 
@@ -1383,38 +2412,127 @@ ao_device *ao_open_file (int driver_id, const char *filename, int overwrite,
 
 int ao_play(ao_device *device, char* output_samples, uint_32 num_bytes)
 {
-	char *playback_buffer;
-
 	if (device == NULL)
 	  return 0;
 
-	if (device->swap_buffer != NULL) {
-          int out_bytes = num_bytes*device->output_channels/device->input_channels;
-          if (_realloc_swap_buffer(device, out_bytes)) {
-            int i;
-            int swap = (device->bytewidth>1 &&
-                        device->client_byte_format != device->driver_byte_format);
-            for(i=0;i<device->output_channels;i++){
-              int ic = device->inter_permute ? device->inter_permute[i] : i;
-              if(ic==-1){
-                _buffer_zero(device->swap_buffer,i,device->bytewidth,device->output_channels,
-                             out_bytes);
-              }else if(swap){
-                _buffer_permute_swap(device->swap_buffer,i,device->bytewidth,device->output_channels,
-                                     out_bytes, output_samples, ic, device->input_channels);
-              }else{
-                _buffer_permute(device->swap_buffer,i,device->bytewidth,device->output_channels,
-                                out_bytes, output_samples, ic, device->input_channels);
-              }
-            }
-            playback_buffer = device->swap_buffer;
-            num_bytes = out_bytes;
-          } else
-            return 0; /* Could not expand swap buffer */
-	} else
-          playback_buffer = output_samples;
+	if (device->async != NULL)
+	  return _async_play_blocking(device->async, output_samples, num_bytes);
 
-	return device->funcs->play(device, playback_buffer, num_bytes);
+	return _play_now(device, output_samples, num_bytes);
+}
+
+
+int ao_async_start(ao_device *device, uint_32 buffer_bytes)
+{
+#ifdef HAVE_LIBPTHREAD
+  ao_async *a;
+  uint_32 frame_bytes;
+
+  if(device == NULL || device->async != NULL)
+    return 0;
+
+  frame_bytes = device->bytewidth*device->input_channels;
+  a = calloc(1,sizeof(*a));
+  if(a == NULL)
+    return 0;
+  a->frame_bytes = frame_bytes;
+  a->bytes_per_sec = frame_bytes*device->rate;
+  if(buffer_bytes == 0)
+    buffer_bytes = a->bytes_per_sec/1000*DEF_ASYNC_BUF_MS;
+  a->size = buffer_bytes - buffer_bytes % frame_bytes;
+  if(a->size < frame_bytes*ASYNC_CHUNKS)
+    a->size = frame_bytes*ASYNC_CHUNKS;
+  a->chunk = a->size/ASYNC_CHUNKS;
+  a->chunk -= a->chunk % frame_bytes;
+  a->ring = malloc(a->size);
+  if(a->ring == NULL){
+    free(a);
+    return 0;
+  }
+
+  pthread_mutex_init(&a->mutex,NULL);
+  pthread_cond_init(&a->queued_cond,NULL);
+  pthread_cond_init(&a->space_cond,NULL);
+  device->async = a;
+  if(pthread_create(&a->thread,NULL,_async_writer,device)){
+    pthread_cond_destroy(&a->space_cond);
+    pthread_cond_destroy(&a->queued_cond);
+    pthread_mutex_destroy(&a->mutex);
+    free(a->ring);
+    free(a);
+    device->async = NULL;
+    return 0;
+  }
+  return 1;
+#else
+  return 0;
+#endif
+}
+
+
+int ao_async_play(ao_device *device, char *output_samples, uint_32 num_bytes)
+{
+#ifdef HAVE_LIBPTHREAD
+  if(device == NULL || device->async == NULL)
+    return -1;
+  return _async_write(device->async, output_samples, num_bytes);
+#else
+  return -1;
+#endif
+}
+
+
+uint_32 ao_async_space(ao_device *device)
+{
+#ifdef HAVE_LIBPTHREAD
+  ao_async *a;
+  uint_32 space;
+
+  if(device == NULL || (a = device->async) == NULL)
+    return 0;
+  pthread_mutex_lock(&a->mutex);
+  space = a->failed ? 0 : a->size - a->queued;
+  pthread_mutex_unlock(&a->mutex);
+  return space - space % a->frame_bytes;
+#else
+  return 0;
+#endif
+}
+
+
+uint_32 ao_async_latency(ao_device *device)
+{
+#ifdef HAVE_LIBPTHREAD
+  ao_async *a;
+  uint_32 queued;
+
+  if(device == NULL || (a = device->async) == NULL)
+    return 0;
+  pthread_mutex_lock(&a->mutex);
+  queued = a->queued;
+  pthread_mutex_unlock(&a->mutex);
+  return (uint_32)((double)queued*1000/a->bytes_per_sec);
+#else
+  return 0;
+#endif
+}
+
+
+uint_32 ao_async_underruns(ao_device *device)
+{
+#ifdef HAVE_LIBPTHREAD
+  ao_async *a;
+  uint_32 underruns;
+
+  if(device == NULL || (a = device->async) == NULL)
+    return 0;
+  pthread_mutex_lock(&a->mutex);
+  underruns = a->underruns;
+  pthread_mutex_unlock(&a->mutex);
+  return underruns;
+#else
+  return 0;
+#endif
 }
 
 
@@ -1425,7 +2543,15 @@ int ao_close(ao_device *device)
 	if (device == NULL)
 		result = 0;
 	else {
-		result = device->funcs->close(device);
+		if (device->async != NULL)
+			_async_stop(device);
+		result = 1;
+		if (device->resampler != NULL) {
+			result = _resample_flush(device);
+			_free_resampler(device->resampler);
+		}
+		if (!device->funcs->close(device))
+			result = 0;
 		device->funcs->device_clear(device);
 
 		if (device->file) {
@@ -1460,7 +2586,7 @@ int ao_driver_id(const char *short_name)
 	i = 0;
 	while (driver) {
 		if (strcmp(short_name,
-			   driver->functions->driver_info()->short_name) == 0)
+			   _driver_info(driver)->short_name) == 0)
 			return i;
 		driver = driver->next;
 		i++;
@@ -1483,7 +2609,9 @@ ao_info *ao_driver_info(int driver_id)
 	driver_list *driver;
 
 	if ( (driver = _get_driver(driver_id)) ) {
-		if (driver->functions->driver_info != NULL)
+		if (driver->info != NULL)
+			return driver->info;
+		else if (driver->functions->driver_info != NULL)
 			return driver->functions->driver_info();
 		else
 			return NULL;
@@ -1502,8 +2630,10 @@ const char *ao_file_extension(int driver_id)
 {
 	driver_list *driver;
 
+	/* Plugins have no file extension, loaded or not */
 	if ( (driver = _get_driver(driver_id)) ) {
-		if (driver->functions->file_extension != NULL)
+		if (driver->functions != NULL &&
+		    driver->functions->file_extension != NULL)
 			return driver->functions->file_extension();
 		else
 			return NULL;
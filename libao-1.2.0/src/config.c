@@ -70,6 +70,13 @@ static int ao_read_config_file(ao_config *config, const char *config_file)
 				line[end-1] = 0; /* Remove trailing newline */
 
 			config->default_driver = strdup(line+15);
+		}else if (strncmp(line, "plugin_cache=", 13) == 0) {
+			free(config->plugin_cache);
+			end = strlen(line);
+			if (line[end-1] == '\n')
+				line[end-1] = 0; /* Remove trailing newline */
+
+			config->plugin_cache = strdup(line+13);
 		}else{
                         /* entries in the config file that don't parse as
                            directives to AO at large are treated as driver
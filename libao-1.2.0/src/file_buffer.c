@@ -0,0 +1,271 @@
+/*
+ *
+ *  file_buffer.c
+ *
+ *      Buffered and memory mapped output for the file drivers
+ *
+ *  This file is part of libao, a cross-platform audio output library.  See
+ *  README for a history of this source code.
+ *
+ *  libao is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  libao is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GNU Make; see the file COPYING.  If not, write to
+ *  the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ ********************************************************************/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <unistd.h>
+#ifndef _WIN32
+#include <sys/mman.h>
+#endif
+
+#include "ao/ao.h"
+#include "ao_private.h"
+
+#define FILE_BUF_ALIGN  4096   /* buffer address and size are multiples of
+                                  this, or of the page size if larger */
+
+struct ao_file_buffer {
+	int    fd;
+	off_t  pos;      /* file offset the next byte goes to */
+
+	/* buffered: bytes waiting to be written at pos - used */
+	char  *buffer;
+	size_t size;
+	size_t used;
+
+	/* mapped: the window of the file at window_start, which the
+	   file has been extended to cover */
+	int    mapped;
+	char  *window;
+	off_t  window_start;
+	off_t  length;
+};
+
+
+/* ---------- Static Helpers ---------- */
+
+/* Mapped windows must start on a page, which is not always 4K */
+static size_t _page_size(void)
+{
+#ifndef _WIN32
+	long page = sysconf(_SC_PAGESIZE);
+
+	if (page > FILE_BUF_ALIGN)
+		return page;
+#endif
+	return FILE_BUF_ALIGN;
+}
+
+static int _write_all(int fd, const char *data, size_t bytes)
+{
+	while (bytes > 0) {
+		ssize_t done = write(fd, data, bytes);
+
+		if (done < 0) {
+			if (errno == EINTR)
+				continue;
+			return 0;
+		}
+		data += done;
+		bytes -= done;
+	}
+
+	return 1;
+}
+
+static int _flush(ao_file_buffer *fb)
+{
+	int ok = _write_all(fb->fd, fb->buffer, fb->used);
+
+	fb->used = 0;
+	return ok;
+}
+
+#ifndef _WIN32
+/* Move the window to the one holding 'start', growing the file by a
+   window at a time */
+static int _map_window(ao_file_buffer *fb, off_t start)
+{
+	if (fb->window)
+		munmap(fb->window, fb->size);
+	fb->window = NULL;
+
+	if (start + (off_t)fb->size > fb->length) {
+		if (ftruncate(fb->fd, start + fb->size) < 0)
+			return 0;
+		fb->length = start + fb->size;
+	}
+
+	fb->window = mmap(NULL, fb->size, PROT_READ | PROT_WRITE, MAP_SHARED,
+			  fb->fd, start);
+	if (fb->window == MAP_FAILED) {
+		fb->window = NULL;
+		return 0;
+	}
+	fb->window_start = start;
+
+	return 1;
+}
+#endif
+
+/* Switch to buffered writes at pos, dropping whatever the windows grew
+   the file by past it */
+static int _use_buffer(ao_file_buffer *fb)
+{
+#ifndef _WIN32
+	if (fb->mapped) {
+		if (fb->window)
+			munmap(fb->window, fb->size);
+		fb->window = NULL;
+		fb->mapped = 0;
+		if (fb->length > fb->pos && ftruncate(fb->fd, fb->pos) < 0)
+			return 0;
+		if (lseek(fb->fd, fb->pos, SEEK_SET) < 0)
+			return 0;
+	}
+
+	if (posix_memalign((void **)&fb->buffer, _page_size(), fb->size) != 0)
+		fb->buffer = NULL;
+#else
+	fb->buffer = malloc(fb->size);
+#endif
+
+	return fb->buffer != NULL;
+}
+
+
+/* ---------- Internal Functions ---------- */
+
+ao_file_buffer *ao_file_buffer_open(ao_device *device, uint_32 size,
+				    int use_mmap)
+{
+	ao_file_buffer *fb;
+	size_t align;
+
+	if (fflush(device->file) != 0)
+		return NULL;
+
+	fb = calloc(1, sizeof(ao_file_buffer));
+	if (fb == NULL)
+		return NULL;
+
+	if (size == 0)
+		size = AO_FILE_BUF_SIZE;
+	align = _page_size();
+	fb->size = (size + align - 1) / align * align;
+	fb->fd = fileno(device->file);
+
+	/* Pipes and terminals have no offset and can only be buffered */
+	fb->pos = lseek(fb->fd, 0, SEEK_CUR);
+	if (fb->pos < 0) {
+		fb->pos = 0;
+		use_mmap = 0;
+	}
+
+#ifndef _WIN32
+	if (use_mmap) {
+		fb->length = fb->pos;
+		fb->mapped = 1;
+		if (_map_window(fb, fb->pos - fb->pos % fb->size))
+			return fb;
+
+		/* Eg, a file opened write only by the caller */
+		averbose("cannot map the output file (%s), buffering writes instead\n",
+			 strerror(errno));
+	}
+#endif
+
+	if (!_use_buffer(fb)) {
+		free(fb);
+		return NULL;
+	}
+
+	return fb;
+}
+
+int ao_file_buffer_write(ao_file_buffer *fb, const char *data,
+			 uint_32 num_bytes)
+{
+#ifndef _WIN32
+	if (fb->mapped) {
+		while (num_bytes > 0) {
+			off_t offset = fb->pos - fb->window_start;
+			uint_32 bytes;
+
+			if (fb->window == NULL || offset >= (off_t)fb->size) {
+				if (!_map_window(fb, fb->pos - fb->pos % fb->size)) {
+					/* Eg, out of address space */
+					if (!_use_buffer(fb))
+						return 0;
+					return ao_file_buffer_write(fb, data, num_bytes);
+				}
+				offset = fb->pos - fb->window_start;
+			}
+			bytes = fb->size - offset;
+			if (bytes > num_bytes)
+				bytes = num_bytes;
+
+			memcpy(fb->window + offset, data, bytes);
+			fb->pos += bytes;
+			data += bytes;
+			num_bytes -= bytes;
+		}
+		return 1;
+	}
+#endif
+
+	fb->pos += num_bytes;
+
+	if (fb->used + num_bytes > fb->size && !_flush(fb))
+		return 0;
+
+	/* A block as large as the buffer gains nothing from the copy */
+	if (num_bytes >= fb->size)
+		return _write_all(fb->fd, data, num_bytes);
+
+	memcpy(fb->buffer + fb->used, data, num_bytes);
+	fb->used += num_bytes;
+
+	return 1;
+}
+
+int ao_file_buffer_close(ao_file_buffer *fb, long *size)
+{
+	int ok = 1;
+
+#ifndef _WIN32
+	if (fb->mapped) {
+		if (fb->window)
+			munmap(fb->window, fb->size);
+		/* Drop the unused end of the last window */
+		if (ftruncate(fb->fd, fb->pos) < 0)
+			ok = 0;
+	}
+	else
+#endif
+	if (fb->used > 0)
+		ok = _flush(fb);
+
+	if (size)
+		*size = fb->pos;
+
+	free(fb->buffer);
+	free(fb);
+
+	return ok;
+}
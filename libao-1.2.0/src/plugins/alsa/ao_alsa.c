@@ -46,6 +46,9 @@
 /* default we be calculated to be 1/4 of the buffer time */
 #define AO_ALSA_PERIOD_TIME 0
 
+/* hardware rates this close to the requested one are played as-is */
+#define AO_ALSA_RATE_TOLERANCE 0.005
+
 /* set mmap to default if enabled at compile time, otherwise, mmap isn't
    the default */
 #ifdef USE_ALSA_MMIO
@@ -376,10 +379,15 @@ static inline int alsa_set_hwparams(ao_device *device,
           adebug("snd_pcm_hw_params_set_rate_near() failed.\n");
           return err;
         }
-	if (rate > 1.05 * format->rate || rate < 0.95 * format->rate) {
-          awarn("sample rate %i not supported "
-                "by the hardware, using %u\n", format->rate, rate);
-	}
+	/* Within the tolerance play at the requested rate, as libao always
+	   did; further off, ao_play resamples to what the hardware gave us */
+	internal->sample_rate = rate;
+	if (rate > (1.0 + AO_ALSA_RATE_TOLERANCE) * format->rate ||
+	    rate < (1.0 - AO_ALSA_RATE_TOLERANCE) * format->rate)
+	  device->output_rate = rate;
+	else if (rate != (unsigned int)format->rate)
+	  adebug("sample rate %u is close enough to %i, not resampling\n",
+	         rate, format->rate);
 
 	/* set the time per hardware sample transfer */
         if(internal->period_time==0)